@@ -0,0 +1,51 @@
+#ifndef LOG_BUFFER_H
+#define LOG_BUFFER_H
+
+#include <stddef.h>
+
+/**
+ * Per-thread log buffers, shared by the runtimes of the labs.
+ *
+ * Each thread appends to its own buffer for each log file, so hooks take
+ * no shared lock and lines from different threads never interleave. All
+ * buffers are kept in a global lock-free list: a thread pushes a new buffer
+ * with a compare-and-swap, or adopts one released by a thread that has
+ * exited. A buffer goes to its log in one write() when it is full, when its
+ * thread exits, at exit and on a fatal signal. Logs are opened once with
+ * O_APPEND, so chunks from different threads and processes do not overlap.
+ *
+ * Every thread that logs gets an alternate signal stack, so the logs are
+ * flushed even when a stack overflow kills the program. What is still
+ * buffered is lost when neither exit handlers nor signal handlers run: on
+ * _exit, on SIGKILL, and for the buffer of a thread that is in the middle
+ * of an append when a fatal signal arrives.
+ */
+#define LOG_BUFFER_SIZE (1 << 16)
+#define MAX_LOGS 4
+
+#define LOG_BUFFER_API __attribute__((visibility("hidden")))
+
+/**
+ * Extensions of the log files of the runtime, indexed by log, up to the
+ * first NULL. Defined by each runtime.
+ */
+extern const char *const log_extensions[MAX_LOGS] LOG_BUFFER_API;
+
+/**
+ * Write the path of the executable followed by ext to buf. Defined by each
+ * runtime.
+ */
+void get_logfile(char *buf, const int buf_size, const char *ext);
+
+/**
+ * Append size bytes of data to log, opening it on first use.
+ */
+void log_append(int log, const void *data, size_t size) LOG_BUFFER_API;
+
+/**
+ * Call hook when a fatal signal kills the program, after the logs are
+ * flushed. Hooks must only use async-signal-safe calls.
+ */
+void log_on_fatal_signal(void (*hook)(void)) LOG_BUFFER_API;
+
+#endif // LOG_BUFFER_H
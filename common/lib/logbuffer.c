@@ -0,0 +1,243 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "LogBuffer.h"
+
+#define LOGFILE_MAX_SIZE 1024
+#define MAX_FATAL_SIGNAL_HOOKS 8
+#define SIGNAL_STACK_SIZE (1 << 16)
+
+typedef void (*fatal_signal_hook)(void);
+
+static atomic_int log_fds[MAX_LOGS] = {-1, -1, -1, -1};
+
+typedef struct log_buffer {
+  struct log_buffer *next;
+  /* Held by the owning thread while appending, and while flushing. */
+  atomic_flag busy;
+  /* Cleared when the owning thread exits, so the buffer can be reused. */
+  atomic_int owned;
+  int log;
+  size_t size;
+  char data[LOG_BUFFER_SIZE];
+} log_buffer;
+
+static _Atomic(log_buffer *) log_buffers = NULL;
+static __thread log_buffer *thread_buffers[MAX_LOGS];
+static __thread void *thread_signal_stack = NULL;
+static pthread_key_t thread_exit_key;
+static pthread_once_t log_init_once = PTHREAD_ONCE_INIT;
+
+static _Atomic(fatal_signal_hook) fatal_signal_hooks[MAX_FATAL_SIGNAL_HOOKS];
+static atomic_int num_fatal_signal_hooks = 0;
+static pthread_once_t signals_init_once = PTHREAD_ONCE_INIT;
+
+/* Write out a buffer. Only uses async-signal-safe calls. */
+static void write_buffer(log_buffer *buffer) {
+  const char *data = buffer->data;
+  size_t size = buffer->size;
+  int fd = atomic_load(&log_fds[buffer->log]);
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written <= 0) {
+      break;
+    }
+    data += written;
+    size -= written;
+  }
+  buffer->size = 0;
+}
+
+/* Buffers busy in an append, e.g. in the thread that caught a signal,
+ * are skipped rather than waited for. */
+static void flush_logs(void) {
+  log_buffer *buffer = atomic_load(&log_buffers);
+  for (; buffer != NULL; buffer = buffer->next) {
+    if (!atomic_flag_test_and_set_explicit(&buffer->busy,
+                                           memory_order_acquire)) {
+      write_buffer(buffer);
+      atomic_flag_clear_explicit(&buffer->busy, memory_order_release);
+    }
+  }
+}
+
+/* Save what a run that is about to die has buffered, then die. */
+static void flush_on_signal(int sig) {
+  flush_logs();
+  int count = atomic_load(&num_fatal_signal_hooks);
+  for (int i = 0; i < count && i < MAX_FATAL_SIGNAL_HOOKS; ++i) {
+    fatal_signal_hook hook = atomic_load(&fatal_signal_hooks[i]);
+    if (hook != NULL) {
+      hook();
+    }
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+/* The handler runs on the alternate stack of the thread, if it has one, so
+ * that a stack overflow does not lose the logs. */
+static void init_signals(void) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = flush_on_signal;
+  action.sa_flags = SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  int fatal_signals[] = {SIGFPE, SIGSEGV, SIGBUS, SIGILL, SIGABRT};
+  for (size_t i = 0; i < sizeof(fatal_signals) / sizeof(int); ++i) {
+    sigaction(fatal_signals[i], &action, NULL);
+  }
+}
+
+void log_on_fatal_signal(void (*hook)(void)) {
+  int index = atomic_fetch_add(&num_fatal_signal_hooks, 1);
+  if (index >= MAX_FATAL_SIGNAL_HOOKS) {
+    fprintf(stderr, "Error: Too many fatal signal hooks\n");
+    exit(1);
+  }
+  atomic_store(&fatal_signal_hooks[index], hook);
+  pthread_once(&signals_init_once, init_signals);
+}
+
+/* Give the thread a signal stack, unless it already has one. */
+static void init_signal_stack(void) {
+  stack_t stack;
+  if (sigaltstack(NULL, &stack) == -1 || !(stack.ss_flags & SS_DISABLE)) {
+    return;
+  }
+  void *data = mmap(NULL, SIGNAL_STACK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return;
+  }
+  stack.ss_sp = data;
+  stack.ss_size = SIGNAL_STACK_SIZE;
+  stack.ss_flags = 0;
+  if (sigaltstack(&stack, NULL) == -1) {
+    munmap(data, SIGNAL_STACK_SIZE);
+    return;
+  }
+  thread_signal_stack = data;
+}
+
+static void release_signal_stack(void) {
+  if (thread_signal_stack == NULL) {
+    return;
+  }
+  stack_t stack;
+  memset(&stack, 0, sizeof(stack));
+  stack.ss_flags = SS_DISABLE;
+  sigaltstack(&stack, NULL);
+  munmap(thread_signal_stack, SIGNAL_STACK_SIZE);
+  thread_signal_stack = NULL;
+}
+
+static void release_thread_buffers(void *unused __attribute__((unused))) {
+  for (size_t log = 0; log < MAX_LOGS; ++log) {
+    log_buffer *buffer = thread_buffers[log];
+    if (buffer == NULL) {
+      continue;
+    }
+    while (atomic_flag_test_and_set_explicit(&buffer->busy,
+                                             memory_order_acquire)) {
+    }
+    write_buffer(buffer);
+    atomic_flag_clear_explicit(&buffer->busy, memory_order_release);
+    atomic_store(&buffer->owned, 0);
+    thread_buffers[log] = NULL;
+  }
+  release_signal_stack();
+}
+
+/* A forked child must not write out what its parent has buffered. */
+static void reset_logs_after_fork(void) {
+  log_buffer *buffer = atomic_load(&log_buffers);
+  for (; buffer != NULL; buffer = buffer->next) {
+    buffer->size = 0;
+  }
+}
+
+static void init_logs(void) {
+  pthread_key_create(&thread_exit_key, release_thread_buffers);
+  pthread_atfork(NULL, NULL, reset_logs_after_fork);
+  atexit(flush_logs);
+  pthread_once(&signals_init_once, init_signals);
+}
+
+static void open_log(int log) {
+  if (atomic_load(&log_fds[log]) != -1) {
+    return;
+  }
+  char logfile[LOGFILE_MAX_SIZE];
+  get_logfile(logfile, sizeof(logfile), log_extensions[log]);
+  int fd = open(logfile, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd == -1) {
+    fprintf(stderr, "Error: Cannot create %s\n", logfile);
+    exit(1);
+  }
+  int expected = -1;
+  if (!atomic_compare_exchange_strong(&log_fds[log], &expected, fd)) {
+    close(fd);
+  }
+}
+
+static log_buffer *get_buffer(int log) {
+  log_buffer *buffer = thread_buffers[log];
+  if (buffer != NULL) {
+    return buffer;
+  }
+  if (log < 0 || log >= MAX_LOGS || log_extensions[log] == NULL) {
+    fprintf(stderr, "Error: Unknown log %d\n", log);
+    exit(1);
+  }
+  pthread_once(&log_init_once, init_logs);
+  open_log(log);
+  if (thread_signal_stack == NULL) {
+    init_signal_stack();
+  }
+
+  for (buffer = atomic_load(&log_buffers); buffer != NULL;
+       buffer = buffer->next) {
+    int released = 0;
+    if (buffer->log == log &&
+        atomic_compare_exchange_strong(&buffer->owned, &released, 1)) {
+      break;
+    }
+  }
+  if (buffer == NULL) {
+    buffer = mmap(NULL, sizeof(log_buffer), PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+      fprintf(stderr, "Error: Cannot allocate log buffer\n");
+      exit(1);
+    }
+    buffer->log = log;
+    atomic_init(&buffer->owned, 1);
+    buffer->next = atomic_load(&log_buffers);
+    while (!atomic_compare_exchange_weak(&log_buffers, &buffer->next, buffer)) {
+    }
+  }
+  thread_buffers[log] = buffer;
+  pthread_setspecific(thread_exit_key, buffer);
+  return buffer;
+}
+
+void log_append(int log, const void *data, size_t size) {
+  log_buffer *buffer = get_buffer(log);
+  while (atomic_flag_test_and_set_explicit(&buffer->busy,
+                                           memory_order_acquire)) {
+  }
+  if (buffer->size + size > LOG_BUFFER_SIZE) {
+    write_buffer(buffer);
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+  atomic_flag_clear_explicit(&buffer->busy, memory_order_release);
+}
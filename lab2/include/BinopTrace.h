@@ -0,0 +1,24 @@
+#ifndef BINOP_TRACE_H
+#define BINOP_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Binary trace written by __binop_op__ to <executable>.binops.bin.
+ *
+ * The file is a plain sequence of fixed-size records in host byte order,
+ * appended by every run of the executable. binop-decode turns it back
+ * into the human-readable .binops text.
+ */
+typedef struct {
+  int32_t line;
+  int32_t col;
+  int32_t op1;
+  int32_t op2;
+  char op;
+  char pad[3];
+} binop_record;
+
+#define BINOP_TRACE_EXTENSION ".binops.bin"
+
+#endif // BINOP_TRACE_H
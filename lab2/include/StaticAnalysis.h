@@ -0,0 +1,21 @@
+#ifndef STATIC_ANALYSIS_H
+#define STATIC_ANALYSIS_H
+
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace instrument {
+
+/**
+ * Run the static analysis on F and print its results to OS.
+ *
+ * Shared by StaticAnalysisPass, which prints to outs(), and the
+ * static-analysis batch driver, which buffers the output of each module.
+ */
+void analyzeFunction(Function &F, raw_ostream &OS);
+
+} // namespace instrument
+
+#endif // STATIC_ANALYSIS_H
@@ -2,6 +2,10 @@
 #define UTILS_H
 
 #include "llvm/IR/Instruction.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+
+#include <memory>
+#include <unordered_map>
 
 using namespace llvm;
 
@@ -26,4 +30,29 @@ const std::string getBinOpName(const char symbol);
  */
 std::string variable(Value *V);
 
+/**
+ * Cached replacement for variable() when naming many values of one function.
+ *
+ * Names are exactly those returned by variable(), but slots are numbered
+ * once per function by a ModuleSlotTracker instead of on every call, and
+ * each value is only converted to a string the first time it is named.
+ */
+class ValueNamer {
+public:
+  explicit ValueNamer(const Function &F) : F(F) {}
+
+  /**
+   * Get the name of V, as variable(V) would print it. The name stays valid
+   * as long as the ValueNamer, however many values are named after it.
+   */
+  const std::string &name(Value *V);
+
+private:
+  const Function &F;
+  std::unique_ptr<ModuleSlotTracker> MST;
+  // Nodes of an unordered_map do not move when it grows, unlike the
+  // buckets of a DenseMap, so the names handed out stay put.
+  std::unordered_map<const Value *, std::string> Cache;
+};
+
 #endif // UTILS_H
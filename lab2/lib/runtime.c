@@ -1,26 +1,16 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-const int STR_MAX_SIZE = 1024;
+#include "BinopTrace.h"
+#include "LogBuffer.h"
 
-const char *getBinOpName(char symbol) {
-  switch (symbol) {
-  case '+':
-    return "Addition";
-  case '-':
-    return "Subtraction";
-  case '*':
-    return "Multiplication";
-  case '/':
-    return "Division";
-  case '%':
-    return "Modulo";
-  default:
-    return "Unknown operation";
-  }
-}
+const int STR_MAX_SIZE = 1024;
 
 void get_logfile(char *buf, const int buf_size, const char *ext) {
   char exe[STR_MAX_SIZE];
@@ -40,26 +30,273 @@ void get_logfile(char *buf, const int buf_size, const char *ext) {
   strncat(buf, ext, strlen(ext));
 }
 
+/* Logs written through the shared per-thread buffers, see LogBuffer.h. */
+enum { COVERAGE_LOG, BINOP_LOG };
+
+const char *const log_extensions[MAX_LOGS] = {".cov", BINOP_TRACE_EXTENSION};
+
 void __coverage__(int line, int col) {
+  char entry[32];
+  int size = snprintf(entry, sizeof(entry), "%d, %d\n", line, col);
+  log_append(COVERAGE_LOG, entry, size);
+}
+
+void __binop_op__(char c, int line, int col, int op1, int op2) {
+  binop_record record = {line, col, op1, op2, c, {0}};
+  log_append(BINOP_LOG, &record, sizeof(record));
+}
+
+/*
+ * Site IDs of -binop-sampling and -binop-aggregate are numbered from 0 in
+ * every module. The constructor of each instrumented module registers its
+ * number of sites here and adds the start of the range it gets to the IDs
+ * of its sites, so that sites of different modules never share an ID.
+ */
+int __binop_register_sites__(int count) {
+  static atomic_int next_site = 0;
+  return atomic_fetch_add(&next_site, count);
+}
+
+/*
+ * Sampling support for binaries built with -binop-sampling.
+ *
+ * Every sampled site decrements __binop_countdown__ inline and calls
+ * __binop_sample__ once it reaches zero. BINOP_SAMPLE_RATE (default 100)
+ * is the mean number of executions per sample. With BINOP_SAMPLE_MODE=
+ * bernoulli (the default) the countdown is drawn from a geometric
+ * distribution, so every execution is sampled independently with
+ * probability 1/rate and samples * rate estimates each site's execution
+ * count without bias. BINOP_SAMPLE_MODE=countdown uses a fixed period,
+ * which is cheaper but can alias with loops.
+ *
+ * Per-site sample counts are written to <exe>.binops.samples at exit. They
+ * need stdio, which is not async-signal-safe, so a run killed by a fatal
+ * signal only leaves its trace.
+ */
+int __binop_countdown__ = 1;
+
+typedef struct {
+  int line;
+  int col;
+  char op;
+  long samples;
+} binop_site;
+
+static binop_site *sample_sites = NULL;
+static int sample_sites_size = 0;
+static int sample_rate = 0;
+static int sample_bernoulli = 1;
+static unsigned long long sample_rng_state = 0;
+
+static double sample_uniform(void) {
+  sample_rng_state ^= sample_rng_state << 13;
+  sample_rng_state ^= sample_rng_state >> 7;
+  sample_rng_state ^= sample_rng_state << 17;
+  return ((sample_rng_state >> 11) + 0.5) / (double)(1ULL << 53);
+}
+
+/* Number of executions up to and including the next sampled one. */
+static int next_countdown(void) {
+  if (!sample_bernoulli || sample_rate == 1) {
+    return sample_rate;
+  }
+  double gap = log(sample_uniform()) / log(1.0 - 1.0 / sample_rate);
+  return gap >= INT32_MAX ? INT32_MAX : (int)gap + 1;
+}
+
+static void write_sample_counts(void) {
+  if (sample_sites == NULL) {
+    return;
+  }
   char logfile[STR_MAX_SIZE];
-  get_logfile(logfile, sizeof(logfile), ".cov");
-  FILE *f = fopen(logfile, "a");
-  fprintf(f, "%d, %d\n", line, col);
+  get_logfile(logfile, sizeof(logfile), ".binops.samples");
+  FILE *f = fopen(logfile, "w");
+  if (f == NULL) {
+    return;
+  }
+  fprintf(f, "# mode=%s rate=%d\n",
+          sample_bernoulli ? "bernoulli" : "countdown", sample_rate);
+  fprintf(f, "# site, op, line, col, samples, estimated executions\n");
+  for (int i = 0; i < sample_sites_size; ++i) {
+    binop_site *site = &sample_sites[i];
+    if (site->samples > 0) {
+      fprintf(f, "%d, %c, %d, %d, %ld, %ld\n", i, site->op, site->line,
+              site->col, site->samples, site->samples * sample_rate);
+    }
+  }
   fclose(f);
 }
 
-void __binop_op__(char c, int line, int col, int op1, int op2) {
+/* Returns whether the execution that first reached the countdown counts. */
+static int init_sampling(void) {
+  const char *rate = getenv("BINOP_SAMPLE_RATE");
+  const char *mode = getenv("BINOP_SAMPLE_MODE");
+  sample_rate = rate ? atoi(rate) : 100;
+  if (sample_rate < 1) {
+    sample_rate = 1;
+  }
+  sample_bernoulli = !(mode && strcmp(mode, "countdown") == 0);
+  sample_rng_state = ((unsigned long long)time(NULL) << 32) ^ getpid() ^
+                     0x9e3779b97f4a7c15ULL;
+  atexit(write_sample_counts);
+
+  // The countdown starts at 1, so decide afresh whether this one is sampled.
+  __binop_countdown__ = next_countdown();
+  return --__binop_countdown__ == 0;
+}
+
+void __binop_sample__(int site, char c, int line, int col, int op1, int op2) {
+  if (sample_rate == 0 && !init_sampling()) {
+    return;
+  }
+  __binop_countdown__ = next_countdown();
+
+  if (site >= sample_sites_size) {
+    int size = site + 1 > 2 * sample_sites_size ? site + 1
+                                                : 2 * sample_sites_size;
+    sample_sites = realloc(sample_sites, size * sizeof(binop_site));
+    memset(sample_sites + sample_sites_size, 0,
+           (size - sample_sites_size) * sizeof(binop_site));
+    sample_sites_size = size;
+  }
+  binop_site *s = &sample_sites[site];
+  s->line = line;
+  s->col = col;
+  s->op = c;
+  s->samples++;
+
+  __binop_op__(c, line, col, op1, op2);
+}
+
+/*
+ * Aggregation support for binaries built with -binop-aggregate.
+ *
+ * __binop_aggregate__ keeps a fixed-size summary per site and operand:
+ * count, min, max, number of zero, negative and positive values, and the
+ * most frequent values, tracked with the Space-Saving algorithm (counts
+ * of top values are upper bounds once more than TOP_VALUES distinct values
+ * were seen). Summaries are written to <exe>.binops.summary at exit, so
+ * the output size depends on the number of sites, not the run length.
+ * Like the sample counts, they are not written when a fatal signal kills
+ * the run.
+ */
+#define TOP_VALUES 8
+
+typedef struct {
+  int value;
+  long count;
+} value_count;
+
+typedef struct {
+  int min;
+  int max;
+  long zero;
+  long negative;
+  long positive;
+  value_count top[TOP_VALUES];
+  int top_size;
+} operand_summary;
+
+typedef struct {
+  int line;
+  int col;
+  char op;
+  long count;
+  operand_summary operands[2];
+} site_summary;
+
+static site_summary *summaries = NULL;
+static int summaries_size = 0;
+static pthread_once_t summaries_init_once = PTHREAD_ONCE_INIT;
+
+static void summarize_operand(operand_summary *s, long count, int value) {
+  if (count == 1 || value < s->min) {
+    s->min = value;
+  }
+  if (count == 1 || value > s->max) {
+    s->max = value;
+  }
+  if (value == 0) {
+    s->zero++;
+  } else if (value < 0) {
+    s->negative++;
+  } else {
+    s->positive++;
+  }
+
+  int least = 0;
+  for (int i = 0; i < s->top_size; ++i) {
+    if (s->top[i].value == value) {
+      s->top[i].count++;
+      return;
+    }
+    if (s->top[i].count < s->top[least].count) {
+      least = i;
+    }
+  }
+  if (s->top_size < TOP_VALUES) {
+    s->top[s->top_size].value = value;
+    s->top[s->top_size++].count = 1;
+  } else {
+    s->top[least].value = value;
+    s->top[least].count++;
+  }
+}
+
+static int compare_value_counts(const void *a, const void *b) {
+  long ca = ((const value_count *)a)->count;
+  long cb = ((const value_count *)b)->count;
+  return (ca < cb) - (ca > cb);
+}
+
+static void write_summaries(void) {
   char logfile[STR_MAX_SIZE];
-  get_logfile(logfile, sizeof(logfile), ".binops");
-  FILE *f = fopen(logfile, "a");
-  fprintf(
-    f,
-    "%s on Line %d, Column %d with first operand=%d and second operand=%d\n",
-    getBinOpName(c),
-    line,
-    col,
-    op1,
-    op2
-  );
+  get_logfile(logfile, sizeof(logfile), ".binops.summary");
+  FILE *f = fopen(logfile, "w");
+  if (f == NULL) {
+    return;
+  }
+  fprintf(f, "# site, op, line, col, count, operand, min, max, zero, "
+             "negative, positive, top values (value:count)\n");
+  for (int i = 0; i < summaries_size; ++i) {
+    site_summary *site = &summaries[i];
+    if (site->count == 0) {
+      continue;
+    }
+    for (int k = 0; k < 2; ++k) {
+      operand_summary *s = &site->operands[k];
+      fprintf(f, "%d, %c, %d, %d, %ld, %d, %d, %d, %ld, %ld, %ld,", i,
+              site->op, site->line, site->col, site->count, k + 1, s->min,
+              s->max, s->zero, s->negative, s->positive);
+      value_count top[TOP_VALUES];
+      memcpy(top, s->top, sizeof(top));
+      qsort(top, s->top_size, sizeof(value_count), compare_value_counts);
+      for (int j = 0; j < s->top_size; ++j) {
+        fprintf(f, " %d:%ld", top[j].value, top[j].count);
+      }
+      fprintf(f, "\n");
+    }
+  }
   fclose(f);
 }
+
+static void register_summaries(void) { atexit(write_summaries); }
+
+void __binop_aggregate__(int site, char c, int line, int col, int op1,
+                         int op2) {
+  pthread_once(&summaries_init_once, register_summaries);
+  if (site >= summaries_size) {
+    int size = site + 1 > 2 * summaries_size ? site + 1 : 2 * summaries_size;
+    summaries = realloc(summaries, size * sizeof(site_summary));
+    memset(summaries + summaries_size, 0,
+           (size - summaries_size) * sizeof(site_summary));
+    summaries_size = size;
+  }
+  site_summary *s = &summaries[site];
+  s->line = line;
+  s->col = col;
+  s->op = c;
+  s->count++;
+  summarize_operand(&s->operands[0], s->count, op1);
+  summarize_operand(&s->operands[1], s->count, op2);
+}
@@ -0,0 +1,79 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "BinopTrace.h"
+
+const char *getBinOpName(char symbol) {
+  switch (symbol) {
+  case '+':
+    return "Addition";
+  case '-':
+    return "Subtraction";
+  case '*':
+    return "Multiplication";
+  case '/':
+    return "Division";
+  case '%':
+    return "Modulo";
+  default:
+    return "Unknown operation";
+  }
+}
+
+/**
+ * Convert a binary trace written by __binop_op__ into the .binops text
+ * format. Without an output file, the trace path with its ".bin" suffix
+ * removed is used.
+ *
+ * Usage:
+ * ./binop-decode [binary trace] (output file)
+ */
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [binary trace] (output file)\n", argv[0]);
+    return 1;
+  }
+
+  std::string TracePath(argv[1]);
+  std::string OutPath;
+  if (argc > 2) {
+    OutPath = argv[2];
+  } else {
+    size_t Suffix = TracePath.rfind(".bin");
+    OutPath = Suffix != std::string::npos && Suffix + 4 == TracePath.size()
+                  ? TracePath.substr(0, Suffix)
+                  : TracePath + ".binops";
+  }
+
+  FILE *Trace = fopen(TracePath.c_str(), "rb");
+  if (!Trace) {
+    fprintf(stderr, "%s not found\n", TracePath.c_str());
+    return 1;
+  }
+  FILE *Out = fopen(OutPath.c_str(), "w");
+  if (!Out) {
+    fprintf(stderr, "Cannot write %s\n", OutPath.c_str());
+    return 1;
+  }
+
+  binop_record Records[4096];
+  size_t Count;
+  while ((Count = fread(Records, sizeof(binop_record), 4096, Trace)) > 0) {
+    for (size_t I = 0; I < Count; ++I) {
+      binop_record &R = Records[I];
+      fprintf(Out,
+              "%s on Line %d, Column %d with first operand=%d and second "
+              "operand=%d\n",
+              getBinOpName(R.op), R.line, R.col, R.op1, R.op2);
+    }
+  }
+  bool Truncated = !feof(Trace) || ftell(Trace) % sizeof(binop_record) != 0;
+  fclose(Trace);
+  fclose(Out);
+  if (Truncated) {
+    fprintf(stderr, "Warning: %s ends with a partial record\n",
+            TracePath.c_str());
+  }
+  return 0;
+}
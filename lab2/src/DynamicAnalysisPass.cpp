@@ -1,6 +1,11 @@
 #include "Instrument.h"
 #include "Utils.h"
 
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
 using namespace llvm;
 
 namespace instrument {
@@ -9,11 +14,62 @@ const auto PASS_NAME = "DynamicAnalysisPass";
 const auto PASS_DESC = "Dynamic Analysis Pass";
 const auto COVERAGE_FUNCTION_NAME = "__coverage__";
 const auto BINOP_OPERANDS_FUNCTION_NAME = "__binop_op__";
+const auto BINOP_SAMPLE_FUNCTION_NAME = "__binop_sample__";
+const auto BINOP_AGGREGATE_FUNCTION_NAME = "__binop_aggregate__";
+const auto BINOP_COUNTDOWN_VARIABLE_NAME = "__binop_countdown__";
+const auto BINOP_REGISTER_SITES_FUNCTION_NAME = "__binop_register_sites__";
+const auto SITE_BASE_VARIABLE_NAME = "__binop_site_base";
+const auto NUM_SITES_VARIABLE_NAME = "__binop_num_sites";
+const auto REGISTER_SITES_CONSTRUCTOR_NAME = "__binop_register_module_sites";
+
+/**
+ * When set, the calls to __binop_op__ are guarded by an inline countdown
+ * shared by all sites. Only when it expires is __binop_sample__ called in
+ * their place, which records the operands and restarts the countdown as
+ * configured at run time by BINOP_SAMPLE_RATE and BINOP_SAMPLE_MODE.
+ */
+static cl::opt<bool> Sampling("binop-sampling",
+                              cl::desc("Sample binary operator operands"),
+                              cl::init(false));
+
+/**
+ * When set, the calls to __binop_op__ are replaced by calls to
+ * __binop_aggregate__ with a site ID, and the runtime keeps a summary of the
+ * operand values of each site rather than a trace of every execution.
+ */
+static cl::opt<bool> Aggregate("binop-aggregate",
+                               cl::desc("Summarize binary operator operands "
+                                        "per site instead of tracing them"),
+                               cl::init(false));
+
+/**
+ * @brief Hand out the next site ID of M, to be used before InsertBefore.
+ *
+ * Several modules of a program are instrumented separately, so site IDs
+ * are numbered from 0 in each of them. The first site of M adds a
+ * constructor that registers the number of sites of M, kept in a private
+ * global, with __binop_register_sites__, and stores the start of the range
+ * of IDs it gets in another one. The ID of a site is that base plus its
+ * number in M, so the sites of different modules never share an ID.
+ *
+ * @return Value * The ID of the site.
+ */
+Value *nextSiteId(Module *M, Instruction *InsertBefore);
 
 void instrumentCoverage(Module *M, Instruction &I, int Line, int Col);
 void instrumentBinOpOperands(Module *M, BinaryOperator *BinOp, int Line,
                              int Col);
 
+/**
+ * @brief Sample or aggregate the __binop_op__ calls that
+ * instrumentBinOpOperands inserted into F, as -binop-sampling and
+ * -binop-aggregate ask.
+ *
+ * The calls are rewritten once F is instrumented, so the same tracing
+ * instrumentation serves all three modes.
+ */
+void rewriteBinOpCalls(Module *M, Function &F);
+
 bool Instrument::runOnFunction(Function &F) {
   auto FunctionName = F.getName().str();
   outs() << "Running " << PASS_DESC << " on function " << FunctionName << "\n";
@@ -32,6 +88,22 @@ bool Instrument::runOnFunction(Function &F) {
   M->getOrInsertFunction(BINOP_OPERANDS_FUNCTION_NAME, VoidType, Int8Type,
                          Int32Type, Int32Type, Int32Type, Int32Type);
 
+  if (Sampling && Aggregate) {
+    report_fatal_error("-binop-sampling and -binop-aggregate cannot be "
+                       "combined");
+  }
+  if (Aggregate) {
+    M->getOrInsertFunction(BINOP_AGGREGATE_FUNCTION_NAME, VoidType, Int32Type,
+                           Int8Type, Int32Type, Int32Type, Int32Type,
+                           Int32Type);
+  }
+  if (Sampling) {
+    M->getOrInsertFunction(BINOP_SAMPLE_FUNCTION_NAME, VoidType, Int32Type,
+                           Int8Type, Int32Type, Int32Type, Int32Type,
+                           Int32Type);
+    M->getOrInsertGlobal(BINOP_COUNTDOWN_VARIABLE_NAME, Int32Type);
+  }
+
   for (inst_iterator Iter = inst_begin(F), E = inst_end(F); Iter != E; ++Iter) {
     Instruction &Inst = (*Iter);
     llvm::DebugLoc DebugLoc = Inst.getDebugLoc();
@@ -50,9 +122,49 @@ bool Instrument::runOnFunction(Function &F) {
      */
   }
 
+  if (Sampling || Aggregate) {
+    rewriteBinOpCalls(M, F);
+  }
+
   return true;
 }
 
+Value *nextSiteId(Module *M, Instruction *InsertBefore) {
+  auto &Context = M->getContext();
+  auto *Int32Type = Type::getInt32Ty(Context);
+  auto *Zero = ConstantInt::get(Int32Type, 0);
+
+  auto *NumSites = M->getGlobalVariable(NUM_SITES_VARIABLE_NAME, true);
+  auto *SiteBase = M->getGlobalVariable(SITE_BASE_VARIABLE_NAME, true);
+  if (!NumSites) {
+    NumSites = new GlobalVariable(*M, Int32Type, true,
+                                  GlobalValue::PrivateLinkage, Zero,
+                                  NUM_SITES_VARIABLE_NAME);
+    SiteBase = new GlobalVariable(*M, Int32Type, false,
+                                  GlobalValue::PrivateLinkage, Zero,
+                                  SITE_BASE_VARIABLE_NAME);
+
+    M->getOrInsertFunction(BINOP_REGISTER_SITES_FUNCTION_NAME, Int32Type,
+                           Int32Type);
+    auto *Constructor = Function::Create(
+        FunctionType::get(Type::getVoidTy(Context), false),
+        GlobalValue::InternalLinkage, REGISTER_SITES_CONSTRUCTOR_NAME, M);
+    IRBuilder<> Builder(BasicBlock::Create(Context, "entry", Constructor));
+    auto *Base =
+        Builder.CreateCall(M->getFunction(BINOP_REGISTER_SITES_FUNCTION_NAME),
+                           {Builder.CreateLoad(Int32Type, NumSites)});
+    Builder.CreateStore(Base, SiteBase);
+    Builder.CreateRetVoid();
+    appendToGlobalCtors(*M, Constructor, 0);
+  }
+
+  auto *Id = cast<ConstantInt>(NumSites->getInitializer());
+  NumSites->setInitializer(
+      ConstantInt::get(Int32Type, Id->getZExtValue() + 1));
+  IRBuilder<> Builder(InsertBefore);
+  return Builder.CreateAdd(Builder.CreateLoad(Int32Type, SiteBase), Id);
+}
+
 void instrumentCoverage(Module *M, Instruction &I, int Line, int Col) {
   auto &Context = M->getContext();
   auto *Int32Type = Type::getInt32Ty(Context);
@@ -79,6 +191,46 @@ void instrumentBinOpOperands(Module *M, BinaryOperator *BinOp, int Line,
    */
 }
 
+/**
+ * A sampled call decrements the shared countdown inline and only calls
+ * __binop_sample__, from a block off the hot path, once it reaches zero.
+ */
+void rewriteBinOpCalls(Module *M, Function &F) {
+  auto &Context = M->getContext();
+  auto *Int32Type = Type::getInt32Ty(Context);
+
+  auto *BinOpFunction = M->getFunction(BINOP_OPERANDS_FUNCTION_NAME);
+  std::vector<CallInst *> Calls;
+  for (auto &Inst : instructions(F)) {
+    auto *Call = dyn_cast<CallInst>(&Inst);
+    if (Call && Call->getCalledFunction() == BinOpFunction) {
+      Calls.push_back(Call);
+    }
+  }
+
+  auto *Hook = M->getFunction(Sampling ? BINOP_SAMPLE_FUNCTION_NAME
+                                       : BINOP_AGGREGATE_FUNCTION_NAME);
+  for (auto *Call : Calls) {
+    Instruction *InsertBefore = Call;
+    if (Sampling) {
+      IRBuilder<> Builder(Call);
+      auto *Countdown = M->getGlobalVariable(BINOP_COUNTDOWN_VARIABLE_NAME);
+      auto *Current = Builder.CreateLoad(Int32Type, Countdown);
+      auto *Next = Builder.CreateSub(Current, ConstantInt::get(Int32Type, 1));
+      Builder.CreateStore(Next, Countdown);
+      auto *Expired =
+          Builder.CreateICmpSLE(Next, ConstantInt::get(Int32Type, 0));
+      auto *Weights = MDBuilder(Context).createBranchWeights(1, 1 << 10);
+      InsertBefore = SplitBlockAndInsertIfThen(Expired, Call, false, Weights);
+    }
+
+    std::vector<Value *> Args = {nextSiteId(M, InsertBefore)};
+    Args.insert(Args.end(), Call->arg_begin(), Call->arg_end());
+    CallInst::Create(Hook, Args, "", InsertBefore);
+    Call->eraseFromParent();
+  }
+}
+
 char Instrument::ID = 1;
 static RegisterPass<Instrument> X(PASS_NAME, PASS_NAME, false, false);
 
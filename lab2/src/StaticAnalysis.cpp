@@ -0,0 +1,63 @@
+#include "StaticAnalysis.h"
+#include "Utils.h"
+
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+namespace instrument {
+
+const auto PASS_DESC = "Static Analysis Pass";
+
+/**
+ * When set, every name ValueNamer hands out is checked against the one
+ * variable() prints, and a mismatch is a fatal error.
+ */
+static cl::opt<bool> CheckValueNames("check-value-names",
+                                     cl::desc("Check cached value names "
+                                              "against variable()"),
+                                     cl::init(false));
+
+/**
+ * @brief Name V for the analysis output, as variable(V) would, through the
+ * cache of Namer. With -check-value-names, a mismatch is a fatal error.
+ */
+const std::string &operandName(ValueNamer &Namer, Value *V) {
+  const std::string &Cached = Namer.name(V);
+  if (CheckValueNames && Cached != variable(V)) {
+    report_fatal_error("ValueNamer named " + Twine(variable(V)) + " " +
+                       Twine(Cached));
+  }
+  return Cached;
+}
+
+void analyzeFunction(Function &F, raw_ostream &OS) {
+  auto FunctionName = F.getName().str();
+  OS << "Running " << PASS_DESC << " on function " << FunctionName << "\n";
+
+  OS << "Locating Instructions\n";
+  // Name operands with operandName(Namer, V), which caches the names of F.
+  ValueNamer Namer(F);
+  for (inst_iterator Iter = inst_begin(F), E = inst_end(F); Iter != E; ++Iter) {
+    Instruction &Inst = (*Iter);
+    llvm::DebugLoc DebugLoc = Inst.getDebugLoc();
+    if (!DebugLoc) {
+      // Skip Instruction if it doesn't have debug information.
+      continue;
+    }
+
+    int Line = DebugLoc.getLine();
+    int Col = DebugLoc.getCol();
+    OS << Line << ", " << Col << "\n";
+
+    /**
+     * TODO: Add code to check if the instruction is a BinaryOperator and if so,
+     * print the information about its location and operands as specified in the
+     * Lab document.
+     */
+  }
+}
+
+} // namespace instrument
@@ -0,0 +1,139 @@
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include <algorithm>
+#include <atomic>
+#include <dirent.h>
+#include <future>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "StaticAnalysis.h"
+
+using namespace llvm;
+
+/**
+ * @brief Add Path to Modules, or every .ll and .bc file in it, sorted by
+ * name, if Path is a directory.
+ *
+ * @return int exit status.
+ */
+int collectModules(const std::string &Path, std::vector<std::string> &Modules) {
+  struct stat Buffer;
+  if (stat(Path.c_str(), &Buffer)) {
+    fprintf(stderr, "%s not found\n", Path.c_str());
+    return 1;
+  }
+  if (!S_ISDIR(Buffer.st_mode)) {
+    Modules.push_back(Path);
+    return 0;
+  }
+
+  std::vector<std::string> Found;
+  DIR *Directory = opendir(Path.c_str());
+  struct dirent *Ent;
+  while ((Ent = readdir(Directory)) != NULL) {
+    std::string Name(Ent->d_name);
+    if (StringRef(Name).endswith(".ll") || StringRef(Name).endswith(".bc")) {
+      Found.push_back(Path + "/" + Name);
+    }
+  }
+  closedir(Directory);
+  std::sort(Found.begin(), Found.end());
+  Modules.insert(Modules.end(), Found.begin(), Found.end());
+  return 0;
+}
+
+/// The outcome of analyzing one module: the analysis output, or the parse
+/// error if the module could not be parsed.
+struct ModuleResult {
+  bool Parsed;
+  std::string Output;
+};
+
+/**
+ * @brief Parse one module in its own context and analyze all its functions.
+ *
+ * @param Path Path to a .ll or .bc file.
+ * @return ModuleResult The analysis output for the module, or its parse
+ * error.
+ */
+ModuleResult analyzeModule(const std::string &Path) {
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::string Output;
+  raw_string_ostream OS(Output);
+
+  auto Mod = parseIRFile(Path, Err, Context);
+  if (!Mod) {
+    Err.print("static-analysis", OS);
+    return {false, OS.str()};
+  }
+  for (auto &F : *Mod) {
+    if (!F.isDeclaration()) {
+      instrument::analyzeFunction(F, OS);
+    }
+  }
+  return {true, OS.str()};
+}
+
+/**
+ * Run StaticAnalysisPass on many modules at once, without starting an opt
+ * process per module. Modules are analyzed on a pool of worker threads and
+ * their results are printed in the order the modules were given. Parse
+ * errors go to stderr, and the exit status is 1 if any module failed to
+ * parse.
+ *
+ * Usage:
+ * ./static-analysis (-j jobs) [module or directory]...
+ */
+int main(int argc, char **argv) {
+  unsigned Jobs = std::max(1u, std::thread::hardware_concurrency());
+  int First = 1;
+  if (argc > 2 && std::string(argv[1]) == "-j") {
+    Jobs = std::max(1l, strtol(argv[2], NULL, 10));
+    First = 3;
+  }
+  if (First >= argc) {
+    printf("usage: %s (-j jobs) [module or directory]...\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> Modules;
+  for (int I = First; I < argc; ++I) {
+    if (collectModules(argv[I], Modules)) {
+      return 1;
+    }
+  }
+
+  std::vector<std::promise<ModuleResult>> Results(Modules.size());
+  std::atomic<size_t> Next{0};
+  std::vector<std::thread> Workers;
+  for (unsigned I = 0; I < std::min<size_t>(Jobs, Modules.size()); ++I) {
+    Workers.emplace_back([&]() {
+      for (size_t M = Next++; M < Modules.size(); M = Next++) {
+        Results[M].set_value(analyzeModule(Modules[M]));
+      }
+    });
+  }
+
+  // Print each result as soon as all modules before it are done.
+  int Status = 0;
+  for (auto &Result : Results) {
+    ModuleResult R = Result.get_future().get();
+    if (R.Parsed) {
+      outs() << R.Output;
+      outs().flush();
+    } else {
+      errs() << R.Output;
+      Status = 1;
+    }
+  }
+  for (auto &Worker : Workers) {
+    Worker.join();
+  }
+  return Status;
+}
@@ -1,6 +1,10 @@
 #include "Utils.h"
 
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
 #include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
 
@@ -47,10 +51,10 @@ const std::string getBinOpName(const char symbol) {
   }
 }
 
-std::string variable(Value *V) {
-  std::string Code;
-  raw_string_ostream SS(Code);
-  V->print(SS);
+/**
+ * Extract the name variable() reports from the printed form of a value.
+ */
+static std::string nameFromCode(std::string &Code) {
   Code.erase(0, Code.find_first_not_of(WHITESPACES));
   auto RetVal = Code.substr(0, Code.find_first_of(WHITESPACES));
   if (RetVal == "i32") {
@@ -58,3 +62,40 @@ std::string variable(Value *V) {
   }
   return RetVal;
 }
+
+std::string variable(Value *V) {
+  std::string Code;
+  raw_string_ostream SS(Code);
+  V->print(SS);
+  return nameFromCode(SS.str());
+}
+
+const std::string &ValueNamer::name(Value *V) {
+  auto It = Cache.find(V);
+  if (It != Cache.end()) {
+    return It->second;
+  }
+  if (!MST) {
+    MST.reset(new ModuleSlotTracker(F.getParent(), false));
+    MST->incorporateFunction(F);
+  }
+
+  std::string Code;
+  raw_string_ostream SS(Code);
+  bool IsI32Operand = (isa<Argument>(V) || isa<Constant>(V)) &&
+                      !isa<GlobalValue>(V) && V->getType()->isIntegerTy(32);
+  bool IsValueInstruction = isa<Instruction>(V) && !V->getType()->isVoidTy();
+  if (IsValueInstruction || IsI32Operand) {
+    // These print as "%x = ..." or "i32 <operand>", so printing the operand
+    // alone gives the same name.
+    V->printAsOperand(SS, false, *MST);
+    Code = SS.str();
+    if (IsValueInstruction) {
+      Code = Code.substr(0, Code.find_first_of(WHITESPACES));
+    }
+    return Cache[V] = Code;
+  }
+  // Rare cases such as labels and globals are printed as variable() does.
+  V->print(SS);
+  return Cache[V] = nameFromCode(SS.str());
+}
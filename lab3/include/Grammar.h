@@ -0,0 +1,101 @@
+#ifndef GRAMMAR_H
+#define GRAMMAR_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One symbol on the right hand side of a grammar rule.
+ * Either a nonterminal such as <expr> or a quoted terminal string.
+ */
+struct GrammarSymbol {
+  bool IsTerminal;
+  std::string Text;
+};
+
+/**
+ * @brief Type of a single alternative of a rule: a sequence of symbols.
+ */
+typedef std::vector<GrammarSymbol> Expansion;
+
+/**
+ * @brief Node of a derivation tree.
+ *
+ * Nodes are immutable once built so that unchanged subtrees can be shared
+ * between the parent tree and its mutants in the corpus.
+ *
+ * @param Symbol   nonterminal name, or terminal text for leaves.
+ * @param Terminal is this node a leaf holding terminal text?
+ * @param Children child subtrees, one per symbol of the chosen expansion.
+ * @param Size     number of nodes in this subtree.
+ */
+struct DerivationTree {
+  std::string Symbol;
+  bool Terminal;
+  std::vector<std::shared_ptr<const DerivationTree>> Children;
+  int Size;
+};
+
+typedef std::shared_ptr<const DerivationTree> TreePtr;
+
+/**
+ * @brief A context free grammar read from a simple BNF file.
+ *
+ * The file holds one rule per line:
+ *
+ *   <start> ::= <expr> "\n"
+ *   <expr>  ::= <term> "+" <expr> | <term>
+ *   <term>  ::= "0" | "1" | "(" <expr> ")"
+ *
+ * Lines that are empty or start with '#' are ignored. Terminals are
+ * double quoted and may use the escapes \n, \t, \" and \\. The left hand
+ * side of the first rule is the start symbol.
+ */
+class Grammar {
+public:
+  /**
+   * @brief Read and check a grammar file.
+   *
+   * @param Path Path to the BNF file.
+   * @param Error Set to a description of the problem on failure.
+   * @return bool true on success.
+   */
+  bool load(const std::string &Path, std::string &Error);
+
+  /**
+   * @brief Generate a random derivation tree for the start symbol.
+   */
+  TreePtr generate() const;
+
+  /**
+   * @brief Mutate a tree, leaving Original untouched.
+   *
+   * One of subtree replacement, splicing with a subtree of Donor, or
+   * recursive expansion is applied, picked at random.
+   *
+   * @param Original Tree to mutate.
+   * @param Donor Another tree of the corpus to splice from.
+   * @return TreePtr The mutated tree.
+   */
+  TreePtr mutate(const TreePtr &Original, const TreePtr &Donor) const;
+
+  /**
+   * @brief Concatenate the terminals of a tree into a target input.
+   */
+  static std::string serialize(const TreePtr &Tree);
+
+private:
+  TreePtr expand(const std::string &Symbol, int Depth) const;
+  TreePtr replaceSubtree(const TreePtr &Tree) const;
+  TreePtr spliceSubtree(const TreePtr &Tree, const TreePtr &Donor) const;
+  TreePtr expandRecursion(const TreePtr &Tree) const;
+
+  std::string Start;
+  std::map<std::string, std::vector<Expansion>> Rules;
+  /// Minimum derivation depth of each nonterminal, used to end generation.
+  std::map<std::string, int> MinDepth;
+};
+
+#endif // GRAMMAR_H
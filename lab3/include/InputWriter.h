@@ -0,0 +1,78 @@
+#ifndef INPUT_WRITER_H
+#define INPUT_WRITER_H
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Writes fuzzer inputs to OutDir on a background thread.
+ *
+ * The fuzzing thread hands inputs over through a single-producer,
+ * single-consumer ring buffer and never touches the file system itself.
+ * The writer thread drains whatever is queued in one batch. Inputs are
+ * stored either as OutDir/{success,failure}/inputN files, or, in archive
+ * mode, appended to OutDir/{success,failure}.archive with one
+ * "name offset size" line per input in the matching .index file.
+ */
+class InputWriter {
+public:
+  /**
+   * @brief Start the writer thread. Inputs that cannot be written later
+   * are reported on stderr.
+   *
+   * @param OutDir Path to output directory.
+   * @param Archive Pack inputs into archives instead of one file each.
+   * @return bool false, after reporting why, if the archives cannot be
+   * created.
+   */
+  bool start(const std::string &OutDir, bool Archive);
+
+  /**
+   * @brief Queue an input, waiting only if the queue is full.
+   *
+   * @param Crashing Did the input cause a crash?
+   * @param Index Number of the input within its directory.
+   * @param Input Input string.
+   */
+  void push(bool Crashing, int Index, const std::string &Input);
+
+  /**
+   * @brief Write everything queued so far and stop the writer thread.
+   */
+  void stop();
+
+private:
+  struct Entry {
+    bool Crashing;
+    int Index;
+    std::string Data;
+  };
+
+  struct Archive {
+    std::string Path;
+    FILE *Data = nullptr;
+    FILE *Index = nullptr;
+    long Offset = 0;
+  };
+
+  static const size_t CAPACITY = 4096;
+
+  void run();
+  void write(Entry &E);
+  void closeArchives();
+
+  std::vector<Entry> Slots = std::vector<Entry>(CAPACITY);
+  std::atomic<size_t> Head{0};
+  std::atomic<size_t> Tail{0};
+  std::atomic<bool> Stopping{false};
+  std::thread Worker;
+
+  std::string OutDir;
+  bool UseArchive = false;
+  Archive Archives[2];
+};
+
+#endif // INPUT_WRITER_H
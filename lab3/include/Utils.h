@@ -14,9 +14,39 @@ extern int failureCount;
 /**
  * @brief Initialize the Output Directory for fuzzer.
  *
+ * Also starts the background writer used by storePassingInput and
+ * storeCrashingInput, and installs handlers so that SIGINT, SIGTERM and
+ * SIGHUP stop fuzzing gracefully. Setting FUZZER_ARCHIVE packs inputs into
+ * OutDir/{success,failure}.archive with a matching .index file.
+ *
  * @param OutDir Path to Output Directory.
+ * @return bool false if the archives cannot be created.
+ */
+bool initialize(std::string &OutDir);
+
+/**
+ * @brief Check whether a signal asked the fuzzer to stop.
+ *
+ * @return bool true once SIGINT, SIGTERM or SIGHUP was received.
+ */
+bool stopRequested();
+
+/**
+ * @brief Check whether a run of the target was stopped by one of the
+ * signals that stop the fuzzer, as when timeout signals the whole process
+ * group.
+ *
+ * @param Status Status of the run as returned by runTarget.
+ * @return bool true if the target or its shell died of SIGINT, SIGTERM or
+ * SIGHUP.
+ */
+bool stoppedBySignal(int Status);
+
+/**
+ * @brief Write all queued inputs and stop the background writer.
+ * Registered with atexit by initialize.
  */
-void initialize(std::string &OutDir);
+void flushInputs();
 
 /**
  * @brief Read the file at Path into a string.
@@ -55,6 +85,7 @@ void storeSeed(std::string &OutDir, int randomSeed);
 
 /**
  * @brief Store an input, know to not cause a crash.
+ * The input is queued and written by the background writer.
  *
  * @param Input Input string.
  * @param OutDir Path to output directory.
@@ -63,6 +94,7 @@ void storePassingInput(std::string &Input, std::string &OutDir);
 
 /**
  * @brief Store an input, know to cause a crash.
+ * The input is queued and written by the background writer.
  *
  * @param Input Input string.
  * @param OutDir Path to output directory.
@@ -1,9 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "LogBuffer.h"
 
 const int STR_MAX_SIZE = 1024;
+const unsigned DEFAULT_COVERAGE_MAP_SIZE = 1 << 16;
+
+/* Hash of the functions currently on this thread's call stack. */
+static __thread unsigned __context__ = 0;
 
 void get_logfile(char *buf, const int buf_size, const char *ext) {
   char exe[STR_MAX_SIZE];
@@ -23,6 +29,11 @@ void get_logfile(char *buf, const int buf_size, const char *ext) {
   strncat(buf, ext, strlen(ext));
 }
 
+/* Logs written through the shared per-thread buffers, see LogBuffer.h. */
+enum { COVERAGE_LOG };
+
+const char *const log_extensions[MAX_LOGS] = {".cov"};
+
 void __sanitize__(int divisor, int line, int col) {
   if (divisor == 0) {
     printf("Divide-by-zero detected at line %d and col %d\n", line, col);
@@ -30,10 +41,49 @@ void __sanitize__(int divisor, int line, int col) {
   }
 }
 
+/*
+ * Reached only from the cold branch the Instrument pass emits when a
+ * divisor is zero, so it is kept out of line and never returns.
+ */
+__attribute__((cold, noinline, noreturn)) void __report_div_zero__(int line,
+                                                                   int col) {
+  printf("Divide-by-zero detected at line %d and col %d\n", line, col);
+  exit(1);
+}
+
 void __coverage__(int line, int col) {
-  char logfile[STR_MAX_SIZE];
-  get_logfile(logfile, sizeof(logfile), ".cov");
-  FILE *f = fopen(logfile, "a");
-  fprintf(f, "%d, %d\n", line, col);
-  fclose(f);
+  char entry[32];
+  int size = snprintf(entry, sizeof(entry), "%d, %d\n", line, col);
+  log_append(COVERAGE_LOG, entry, size);
+}
+
+/*
+ * Number of distinct coverage indices, taken from COVERAGE_MAP_SIZE.
+ * Larger maps reduce collisions once the context hash is mixed in.
+ */
+unsigned get_coverage_map_size() {
+  static unsigned map_size = 0;
+  if (map_size == 0) {
+    const char *env = getenv("COVERAGE_MAP_SIZE");
+    long size = env ? strtol(env, NULL, 10) : 0;
+    map_size = size > 0 ? (unsigned)size : DEFAULT_COVERAGE_MAP_SIZE;
+  }
+  return map_size;
+}
+
+void __context_enter__(int id) {
+  __context__ = ((__context__ << 1) | (__context__ >> 31)) ^ (unsigned)id;
+}
+
+void __context_exit__(int id) {
+  unsigned ctx = __context__ ^ (unsigned)id;
+  __context__ = (ctx >> 1) | (ctx << 31);
+}
+
+void __context_coverage__(int line, int col) {
+  unsigned site = (unsigned)line * 31337u ^ (unsigned)col;
+  unsigned index = (site ^ __context__) % get_coverage_map_size();
+  char entry[48];
+  int size = snprintf(entry, sizeof(entry), "%d, %d, %u\n", line, col, index);
+  log_append(COVERAGE_LOG, entry, size);
 }
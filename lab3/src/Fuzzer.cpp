@@ -6,6 +6,7 @@
  * implementation, you don't have to modify it.
  */
 
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -13,12 +14,14 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unordered_set>
 #include <unistd.h>
 
 #include <cstdio>
 #include <cstring>
 #include <string>
 
+#include "Grammar.h"
 #include "Utils.h"
 
 #define ARG_EXIST_CHECK(Name, Arg)                                             \
@@ -212,27 +215,103 @@ int Freq = 1000;
 int Count = 0;
 int PassCount = 0;
 
+/************************************************/
+/*          Statistics for benchmarking         */
+/************************************************/
+
+/// Minimum time between two rows of the stats file.
+const int STATS_INTERVAL_MS = 100;
+
+// Stats file named by the FUZZER_STATS environment variable, if set.
+FILE *StatsFile = nullptr;
+
+// Every coverage entry (site) seen in any run, and every pair of entries
+// that follow each other in the trace of a run (edge).
+std::unordered_set<std::string> StatsSites;
+std::unordered_set<std::string> StatsEdges;
+
+std::chrono::steady_clock::time_point StartTime;
+long LastStatsMs = -STATS_INTERVAL_MS;
+
+long elapsedMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - StartTime)
+      .count();
+}
+
+/**
+ * @brief Add the sites and edges of the last run to the stats. The first
+ * site of a run is an edge from the start of the run.
+ *
+ * @param Target name of target binary
+ */
+void recordCoverage(std::string &Target) {
+  std::vector<std::string> RawCoverageData;
+  readCoverageFile(Target, RawCoverageData);
+  std::string Prev;
+  for (auto &Entry : RawCoverageData) {
+    StatsSites.insert(Entry);
+    StatsEdges.insert(Prev + "\n" + Entry);
+    Prev = Entry;
+  }
+}
+
+/**
+ * @brief Append a row "elapsed_ms, execs, crashes, sites, edges" to
+ * StatsFile.
+ *
+ * @param ElapsedMs time since fuzzing started
+ */
+void writeStatsRow(long ElapsedMs) {
+  LastStatsMs = ElapsedMs;
+  fprintf(StatsFile, "%ld, %d, %d, %zu, %zu\n", ElapsedMs, Count,
+          failureCount, StatsSites.size(), StatsEdges.size());
+  fflush(StatsFile);
+}
+
+/**
+ * @brief Add the coverage of every run to the stats, and write a row every
+ * STATS_INTERVAL_MS, and right away when the first crash is found.
+ *
+ * @param Target name of target binary
+ * @param Passed did the last run pass?
+ */
+void recordStats(std::string &Target, bool Passed) {
+  recordCoverage(Target);
+  long ElapsedMs = elapsedMs();
+  bool FirstCrash = !Passed && failureCount == 1;
+  if (ElapsedMs - LastStatsMs < STATS_INTERVAL_MS && !FirstCrash)
+    return;
+  writeStatsRow(ElapsedMs);
+}
+
 bool test(std::string &Target, std::string &Input, std::string &OutDir) {
   // Clean up old coverage file before running
   std::string CoveragePath = Target + ".cov";
   std::remove(CoveragePath.c_str());
 
-  ++Count;
   int ReturnCode = runTarget(Target, Input);
   if (ReturnCode == 127) {
     fprintf(stderr, "%s not found\n", Target.c_str());
     exit(1);
   }
+  // The signal that stops the fuzzer may have killed the target as well, so
+  // the outcome of this run says nothing about Input.
+  if (stopRequested() || stoppedBySignal(ReturnCode))
+    return true;
+  ++Count;
   fprintf(stderr, "\e[A\rTried %d inputs, %d crashes found\n", Count,
           failureCount);
-  if (ReturnCode == 0) {
+  bool Passed = ReturnCode == 0;
+  if (Passed) {
     if (PassCount++ % Freq == 0)
       storePassingInput(Input, OutDir);
-    return true;
   } else {
     storeCrashingInput(Input, OutDir);
-    return false;
   }
+  if (StatsFile)
+    recordStats(Target, Passed);
+  return Passed;
 }
 
 /**
@@ -243,7 +322,7 @@ bool test(std::string &Target, std::string &Input, std::string &OutDir) {
  */
 void fuzz(std::string Target, std::string OutDir) {
   struct RunInfo Info;
-  while (true) {
+  while (!stopRequested()) {
     std::string Input = selectInput(Info);
     Info = RunInfo();
     Info.Input = Input;
@@ -254,14 +333,62 @@ void fuzz(std::string Target, std::string OutDir) {
   }
 }
 
+/*********************************************/
+/*             Grammar based mode            */
+/*********************************************/
+
+/// Number of freshly generated trees the grammar corpus starts with.
+const int GRAMMAR_INITIAL_CORPUS = 16;
+
+// Grammar used to derive inputs, loaded when a grammar file is given.
+Grammar InputGrammar;
+
+// Derivation trees of the inputs kept so far. Inputs are only serialized
+// from these right before running the target.
+std::vector<TreePtr> TreeCorpus;
+
+// Every coverage entry observed while fuzzing in grammar mode.
+std::set<std::string> SeenCoverage;
+
+/**
+ * @brief Fuzz the Target program with inputs derived from InputGrammar.
+ * A mutant is added to the corpus when it reaches new coverage.
+ *
+ * @param Target Target (instrumented) program binary.
+ * @param OutDir Directory to store fuzzing results.
+ */
+void fuzzGrammar(std::string Target, std::string OutDir) {
+  for (int I = 0; I < GRAMMAR_INITIAL_CORPUS; ++I) {
+    TreeCorpus.push_back(InputGrammar.generate());
+  }
+  while (!stopRequested()) {
+    const TreePtr &Parent = TreeCorpus[rand() % TreeCorpus.size()];
+    const TreePtr &Donor = TreeCorpus[rand() % TreeCorpus.size()];
+    TreePtr Tree = InputGrammar.mutate(Parent, Donor);
+    std::string Input = Grammar::serialize(Tree);
+    test(Target, Input, OutDir);
+
+    std::vector<std::string> RawCoverageData;
+    readCoverageFile(Target, RawCoverageData);
+    bool NewCoverage = false;
+    for (auto &Entry : RawCoverageData) {
+      NewCoverage |= SeenCoverage.insert(Entry).second;
+    }
+    if (NewCoverage) {
+      TreeCorpus.push_back(Tree);
+    }
+  }
+}
+
 /**
  * Usage:
  * ./fuzzer [target] [seed input dir] [output dir] [frequency] [random seed]
+ *          [grammar]
  */
 int main(int argc, char **argv) {
   if (argc < 4) {
     printf("usage %s [target] [seed input dir] [output dir] [frequency "
-           "(optional)] [seed (optional arg)]\n",
+           "(optional)] [seed (optional arg)] [grammar (optional)]\n",
            argv[0]);
     return 1;
   }
@@ -275,15 +402,44 @@ int main(int argc, char **argv) {
 
   int RandomSeed = argc > 5 ? strtol(argv[5], NULL, 10) : (int)time(NULL);
 
+  if (argc > 6) {
+    ARG_EXIST_CHECK(GrammarPath, argv[6]);
+    std::string Error;
+    if (!InputGrammar.load(GrammarPath, Error)) {
+      fprintf(stderr, "Cannot load grammar: %s\n", Error.c_str());
+      return 1;
+    }
+  }
+
+  if (const char *StatsPath = getenv("FUZZER_STATS")) {
+    StatsFile = fopen(StatsPath, "w");
+    if (!StatsFile) {
+      fprintf(stderr, "Cannot open stats file %s\n", StatsPath);
+      return 1;
+    }
+    fprintf(StatsFile, "# elapsed_ms, execs, crashes, sites, edges\n");
+  }
+  StartTime = std::chrono::steady_clock::now();
+
   srand(RandomSeed);
   storeSeed(OutDir, RandomSeed);
-  initialize(OutDir);
+  if (!initialize(OutDir)) {
+    return 1;
+  }
 
   if (readSeedInputs(SeedInputs, SeedInputDir)) {
     fprintf(stderr, "Cannot read seed input directory\n");
     return 1;
   }
   fprintf(stderr, "Fuzzing %s...\n\n", Target.c_str());
-  fuzz(Target, OutDir);
+  if (argc > 6) {
+    fuzzGrammar(Target, OutDir);
+  } else {
+    fuzz(Target, OutDir);
+  }
+  // The last row holds the final counters, whenever the last throttled
+  // row was written.
+  if (StatsFile)
+    writeStatsRow(elapsedMs());
   return 0;
 }
\ No newline at end of file
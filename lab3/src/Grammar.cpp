@@ -0,0 +1,323 @@
+#include "Grammar.h"
+
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+
+/// Past this depth generation only picks the shortest expansions.
+const int MAX_DEPTH = 12;
+
+/// Recursive expansion is skipped for trees bigger than this.
+const int MAX_TREE_SIZE = 4096;
+
+namespace {
+
+TreePtr makeNode(const std::string &Symbol, bool Terminal,
+                 std::vector<TreePtr> Children) {
+  auto Node = std::make_shared<DerivationTree>();
+  Node->Symbol = Symbol;
+  Node->Terminal = Terminal;
+  Node->Size = 1;
+  for (auto &Child : Children) {
+    Node->Size += Child->Size;
+  }
+  Node->Children = std::move(Children);
+  return Node;
+}
+
+/**
+ * @brief Collect the nonterminal nodes of Tree with their preorder index.
+ */
+void collect(const TreePtr &Tree, int Index,
+             std::vector<std::pair<int, TreePtr>> &Nodes) {
+  if (Tree->Terminal) {
+    return;
+  }
+  Nodes.push_back({Index, Tree});
+  Index++;
+  for (auto &Child : Tree->Children) {
+    collect(Child, Index, Nodes);
+    Index += Child->Size;
+  }
+}
+
+/**
+ * @brief Rebuild the path from the root to the node at preorder Index,
+ * putting Replacement in its place. Other subtrees are shared.
+ */
+TreePtr replaceAt(const TreePtr &Tree, int Index, const TreePtr &Replacement) {
+  if (Index == 0) {
+    return Replacement;
+  }
+  Index--;
+  std::vector<TreePtr> Children = Tree->Children;
+  for (auto &Child : Children) {
+    if (Index < Child->Size) {
+      Child = replaceAt(Child, Index, Replacement);
+      break;
+    }
+    Index -= Child->Size;
+  }
+  return makeNode(Tree->Symbol, Tree->Terminal, std::move(Children));
+}
+
+std::string unescape(const std::string &Text) {
+  std::string Result;
+  for (size_t I = 0; I < Text.size(); ++I) {
+    if (Text[I] != '\\' || I + 1 == Text.size()) {
+      Result += Text[I];
+      continue;
+    }
+    char C = Text[++I];
+    Result += C == 'n' ? '\n' : C == 't' ? '\t' : C;
+  }
+  return Result;
+}
+
+/**
+ * @brief Split the right hand side of a rule into its alternatives.
+ */
+bool parseAlternatives(const std::string &Line, size_t Pos,
+                       std::vector<Expansion> &Alternatives,
+                       std::string &Error) {
+  Alternatives.emplace_back();
+  while (Pos < Line.size()) {
+    char C = Line[Pos];
+    if (isspace(C)) {
+      Pos++;
+    } else if (C == '|') {
+      Alternatives.emplace_back();
+      Pos++;
+    } else if (C == '<') {
+      size_t End = Line.find('>', Pos);
+      if (End == std::string::npos) {
+        Error = "unterminated nonterminal in: " + Line;
+        return false;
+      }
+      Alternatives.back().push_back({false, Line.substr(Pos, End - Pos + 1)});
+      Pos = End + 1;
+    } else if (C == '"') {
+      size_t End = Pos + 1;
+      while (End < Line.size() && Line[End] != '"') {
+        End += Line[End] == '\\' ? 2 : 1;
+      }
+      if (End >= Line.size()) {
+        Error = "unterminated terminal in: " + Line;
+        return false;
+      }
+      Alternatives.back().push_back(
+          {true, unescape(Line.substr(Pos + 1, End - Pos - 1))});
+      Pos = End + 1;
+    } else {
+      Error = "unexpected character '" + std::string(1, C) + "' in: " + Line;
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool Grammar::load(const std::string &Path, std::string &Error) {
+  std::ifstream File(Path);
+  if (!File) {
+    Error = "cannot open " + Path;
+    return false;
+  }
+
+  std::string Line;
+  while (std::getline(File, Line)) {
+    size_t Begin = Line.find_first_not_of(" \t\r");
+    if (Begin == std::string::npos || Line[Begin] == '#') {
+      continue;
+    }
+    size_t Arrow = Line.find("::=");
+    size_t NameEnd = Line.find('>', Begin);
+    if (Line[Begin] != '<' || Arrow == std::string::npos ||
+        NameEnd == std::string::npos || NameEnd > Arrow) {
+      Error = "malformed rule: " + Line;
+      return false;
+    }
+    std::string Name = Line.substr(Begin, NameEnd - Begin + 1);
+    if (Start.empty()) {
+      Start = Name;
+    }
+    if (!parseAlternatives(Line, Arrow + 3, Rules[Name], Error)) {
+      return false;
+    }
+  }
+  if (Start.empty()) {
+    Error = "no rules in " + Path;
+    return false;
+  }
+
+  for (auto &Rule : Rules) {
+    for (auto &Alt : Rule.second) {
+      for (auto &Sym : Alt) {
+        if (!Sym.IsTerminal && !Rules.count(Sym.Text)) {
+          Error = "undefined nonterminal " + Sym.Text;
+          return false;
+        }
+      }
+    }
+  }
+
+  // Fixpoint over the minimum depth needed to fully derive each symbol.
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (auto &Rule : Rules) {
+      for (auto &Alt : Rule.second) {
+        int Depth = 1;
+        for (auto &Sym : Alt) {
+          if (Sym.IsTerminal) {
+            continue;
+          }
+          auto It = MinDepth.find(Sym.Text);
+          Depth = It == MinDepth.end() ? INT_MAX
+                                       : std::max(Depth, It->second + 1);
+          if (Depth == INT_MAX) {
+            break;
+          }
+        }
+        auto It = MinDepth.find(Rule.first);
+        if (Depth != INT_MAX && (It == MinDepth.end() || Depth < It->second)) {
+          MinDepth[Rule.first] = Depth;
+          Changed = true;
+        }
+      }
+    }
+  }
+  for (auto &Rule : Rules) {
+    if (!MinDepth.count(Rule.first)) {
+      Error = Rule.first + " cannot derive a finite string";
+      return false;
+    }
+  }
+  return true;
+}
+
+TreePtr Grammar::expand(const std::string &Symbol, int Depth) const {
+  auto &Alternatives = Rules.at(Symbol);
+  const Expansion *Chosen = &Alternatives[rand() % Alternatives.size()];
+
+  if (Depth >= MAX_DEPTH) {
+    // Only consider the alternatives that end the derivation soonest.
+    std::vector<const Expansion *> Shortest;
+    int Best = INT_MAX;
+    for (auto &Alt : Alternatives) {
+      int Cost = 0;
+      for (auto &Sym : Alt) {
+        if (!Sym.IsTerminal) {
+          Cost = std::max(Cost, MinDepth.at(Sym.Text));
+        }
+      }
+      if (Cost < Best) {
+        Best = Cost;
+        Shortest.clear();
+      }
+      if (Cost == Best) {
+        Shortest.push_back(&Alt);
+      }
+    }
+    Chosen = Shortest[rand() % Shortest.size()];
+  }
+
+  std::vector<TreePtr> Children;
+  for (auto &Sym : *Chosen) {
+    Children.push_back(Sym.IsTerminal ? makeNode(Sym.Text, true, {})
+                                      : expand(Sym.Text, Depth + 1));
+  }
+  return makeNode(Symbol, false, std::move(Children));
+}
+
+TreePtr Grammar::generate() const { return expand(Start, 0); }
+
+/**
+ * @brief Subtree replacement: regenerate a random nonterminal node.
+ */
+TreePtr Grammar::replaceSubtree(const TreePtr &Tree) const {
+  std::vector<std::pair<int, TreePtr>> Nodes;
+  collect(Tree, 0, Nodes);
+  auto &Target = Nodes[rand() % Nodes.size()];
+  return replaceAt(Tree, Target.first,
+                   expand(Target.second->Symbol, MAX_DEPTH / 2));
+}
+
+/**
+ * @brief Splice: swap a node for a Donor subtree of the same nonterminal.
+ */
+TreePtr Grammar::spliceSubtree(const TreePtr &Tree,
+                               const TreePtr &Donor) const {
+  std::vector<std::pair<int, TreePtr>> DonorNodes;
+  collect(Donor, 0, DonorNodes);
+  auto &Graft = DonorNodes[rand() % DonorNodes.size()].second;
+
+  std::vector<std::pair<int, TreePtr>> Nodes, Matches;
+  collect(Tree, 0, Nodes);
+  for (auto &Node : Nodes) {
+    if (Node.second->Symbol == Graft->Symbol) {
+      Matches.push_back(Node);
+    }
+  }
+  if (Matches.empty()) {
+    return replaceSubtree(Tree);
+  }
+  return replaceAt(Tree, Matches[rand() % Matches.size()].first, Graft);
+}
+
+/**
+ * @brief Recursive expansion: for a node N with a descendant M of the same
+ * nonterminal, put a copy of N in place of M, repeating the recursion.
+ */
+TreePtr Grammar::expandRecursion(const TreePtr &Tree) const {
+  if (Tree->Size > MAX_TREE_SIZE) {
+    return replaceSubtree(Tree);
+  }
+  std::vector<std::pair<int, TreePtr>> Nodes;
+  collect(Tree, 0, Nodes);
+  auto &Outer = Nodes[rand() % Nodes.size()];
+
+  std::vector<std::pair<int, TreePtr>> Inner, Matches;
+  collect(Outer.second, 0, Inner);
+  for (auto &Node : Inner) {
+    if (Node.first != 0 && Node.second->Symbol == Outer.second->Symbol) {
+      Matches.push_back(Node);
+    }
+  }
+  if (Matches.empty()) {
+    return replaceSubtree(Tree);
+  }
+  auto &Hole = Matches[rand() % Matches.size()];
+  TreePtr Grown = replaceAt(Outer.second, Hole.first, Outer.second);
+  return replaceAt(Tree, Outer.first, Grown);
+}
+
+TreePtr Grammar::mutate(const TreePtr &Original, const TreePtr &Donor) const {
+  switch (rand() % 3) {
+  case 0:
+    return replaceSubtree(Original);
+  case 1:
+    return spliceSubtree(Original, Donor);
+  default:
+    return expandRecursion(Original);
+  }
+}
+
+std::string Grammar::serialize(const TreePtr &Tree) {
+  std::string Result;
+  std::vector<const DerivationTree *> Stack = {Tree.get()};
+  while (!Stack.empty()) {
+    const DerivationTree *Node = Stack.back();
+    Stack.pop_back();
+    if (Node->Terminal) {
+      Result += Node->Symbol;
+      continue;
+    }
+    for (auto It = Node->Children.rbegin(); It != Node->Children.rend(); ++It) {
+      Stack.push_back(It->get());
+    }
+  }
+  return Result;
+}
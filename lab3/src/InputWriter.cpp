@@ -0,0 +1,127 @@
+#include "InputWriter.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+/// How long the writer thread sleeps when the queue is empty.
+const auto IDLE_WAIT = std::chrono::milliseconds(1);
+
+/// Report that Path could not be written, with the reason errno gives.
+static void reportWriteError(const std::string &Path) {
+  fprintf(stderr, "Cannot write %s: %s\n", Path.c_str(), strerror(errno));
+}
+
+bool InputWriter::start(const std::string &Dir, bool Archive) {
+  OutDir = Dir;
+  UseArchive = Archive;
+  if (UseArchive) {
+    const char *Names[] = {"success", "failure"};
+    for (int I = 0; I < 2; ++I) {
+      auto &A = Archives[I];
+      A.Path = OutDir + "/" + Names[I] + ".archive";
+      std::string IndexPath = OutDir + "/" + Names[I] + ".index";
+      A.Data = fopen(A.Path.c_str(), "wb");
+      if (!A.Data) {
+        reportWriteError(A.Path);
+        closeArchives();
+        return false;
+      }
+      A.Index = fopen(IndexPath.c_str(), "w");
+      if (!A.Index) {
+        reportWriteError(IndexPath);
+        closeArchives();
+        return false;
+      }
+    }
+  }
+  Worker = std::thread(&InputWriter::run, this);
+  return true;
+}
+
+void InputWriter::push(bool Crashing, int Index, const std::string &Input) {
+  size_t T = Tail.load(std::memory_order_relaxed);
+  while (T - Head.load(std::memory_order_acquire) == CAPACITY) {
+    std::this_thread::yield();
+  }
+  Entry &E = Slots[T % CAPACITY];
+  E.Crashing = Crashing;
+  E.Index = Index;
+  E.Data = Input;
+  Tail.store(T + 1, std::memory_order_release);
+}
+
+void InputWriter::stop() {
+  if (!Worker.joinable()) {
+    return;
+  }
+  Stopping.store(true);
+  Worker.join();
+  closeArchives();
+}
+
+void InputWriter::closeArchives() {
+  for (auto &A : Archives) {
+    if (A.Data && fclose(A.Data)) {
+      reportWriteError(A.Path);
+    }
+    if (A.Index && fclose(A.Index)) {
+      reportWriteError(A.Path);
+    }
+    A.Data = A.Index = nullptr;
+  }
+}
+
+void InputWriter::run() {
+  while (true) {
+    // Read Stopping first so that nothing pushed before stop() is missed.
+    bool Last = Stopping.load();
+    size_t H = Head.load(std::memory_order_relaxed);
+    size_t T = Tail.load(std::memory_order_acquire);
+    if (H == T) {
+      if (Last) {
+        return;
+      }
+      std::this_thread::sleep_for(IDLE_WAIT);
+      continue;
+    }
+    for (; H != T; ++H) {
+      Entry &E = Slots[H % CAPACITY];
+      write(E);
+      E.Data.clear();
+    }
+    Head.store(T, std::memory_order_release);
+    if (UseArchive) {
+      for (auto &A : Archives) {
+        if (fflush(A.Data) || fflush(A.Index)) {
+          reportWriteError(A.Path);
+        }
+      }
+    }
+  }
+}
+
+void InputWriter::write(Entry &E) {
+  std::string Name = "input" + std::to_string(E.Index);
+  if (!UseArchive) {
+    std::string Path =
+        OutDir + (E.Crashing ? "/failure/" : "/success/") + Name;
+    FILE *F = fopen(Path.c_str(), "wb");
+    if (!F) {
+      reportWriteError(Path);
+      return;
+    }
+    bool Written = fwrite(E.Data.data(), 1, E.Data.size(), F) == E.Data.size();
+    if (fclose(F) || !Written) {
+      reportWriteError(Path);
+    }
+    return;
+  }
+  Archive &A = Archives[E.Crashing];
+  if (fwrite(E.Data.data(), 1, E.Data.size(), A.Data) != E.Data.size() ||
+      fprintf(A.Index, "%s %ld %zu\n", Name.c_str(), A.Offset,
+              E.Data.size()) < 0) {
+    reportWriteError(A.Path + " (" + Name + ")");
+  }
+  A.Offset += E.Data.size();
+}
@@ -1,11 +1,44 @@
 #include "Instrument.h"
 
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
 using namespace llvm;
 
 namespace instrument {
 
-static const char *SANITIZE_FUNCTION_NAME = "__sanitize__";
+static const char *REPORT_DIV_ZERO_FUNCTION_NAME = "__report_div_zero__";
 static const char *COVERAGE_FUNCTION_NAME = "__coverage__";
+static const char *CONTEXT_COVERAGE_FUNCTION_NAME = "__context_coverage__";
+static const char *CONTEXT_ENTER_FUNCTION_NAME = "__context_enter__";
+static const char *CONTEXT_EXIT_FUNCTION_NAME = "__context_exit__";
+
+/**
+ * When set, every function is bracketed with __context_enter__ and
+ * __context_exit__ calls and coverage is reported through
+ * __context_coverage__, which folds the current call-context hash into
+ * the coverage index.
+ */
+static cl::opt<bool>
+    ContextSensitive("context-sensitive",
+                     cl::desc("Make coverage sensitive to the call context"),
+                     cl::init(false));
+
+/**
+ * @brief Stable identifier of a function, used to update the context hash.
+ *
+ * @param F Function to identify.
+ * @return FNV-1a hash of the function name.
+ */
+uint32_t getFunctionId(Function &F) {
+  uint32_t Hash = 2166136261u;
+  for (char C : F.getName()) {
+    Hash ^= static_cast<uint8_t>(C);
+    Hash *= 16777619u;
+  }
+  return Hash;
+}
 
 void instrumentCoverage(Module *M, Instruction &I, int Line, int Col) {
   auto &Context = M->getContext();
@@ -15,21 +48,61 @@ void instrumentCoverage(Module *M, Instruction &I, int Line, int Col) {
   auto *ColVal = llvm::ConstantInt::get(Int32Type, Col);
   std::vector<Value *> Args = {LineVal, ColVal};
 
-  auto *Fun = M->getFunction(COVERAGE_FUNCTION_NAME);
+  auto *Fun = M->getFunction(ContextSensitive ? CONTEXT_COVERAGE_FUNCTION_NAME
+                                              : COVERAGE_FUNCTION_NAME);
   CallInst::Create(Fun, Args, "", &I);
 }
 
+/**
+ * @brief Guard a division with an inline check of its divisor.
+ *
+ * The block is split before I so that the hot path only pays for one
+ * compare and a branch that is predicted not taken. The report call sits
+ * in a separate cold block ending in unreachable.
+ */
 void instrumentSanitize(Module *M, Instruction &I, int Line, int Col) {
   LLVMContext &Context = M->getContext();
   Type *Int32Type = Type::getInt32Ty(Context);
 
   auto *Divisor = I.getOperand(1);
+  auto *IsZero = new ICmpInst(&I, ICmpInst::ICMP_EQ, Divisor,
+                              Constant::getNullValue(Divisor->getType()));
+  auto *Weights = MDBuilder(Context).createBranchWeights(1, 1 << 20);
+  auto *ReportTerm = SplitBlockAndInsertIfThen(IsZero, &I, true, Weights);
+
   auto *LineVal = llvm::ConstantInt::get(Int32Type, Line);
   auto *ColVal = llvm::ConstantInt::get(Int32Type, Col);
-  std::vector<Value *> Args = {Divisor, LineVal, ColVal};
+  std::vector<Value *> Args = {LineVal, ColVal};
 
-  auto *Fun = M->getFunction(SANITIZE_FUNCTION_NAME);
-  CallInst::Create(Fun, Args, "", &I);
+  auto *Fun = M->getFunction(REPORT_DIV_ZERO_FUNCTION_NAME);
+  CallInst::Create(Fun, Args, "", ReportTerm)->setDoesNotReturn();
+}
+
+/**
+ * @brief Update the call-context hash on entry to F and restore it
+ * before every return from F.
+ *
+ * @param M Module containing F.
+ * @param F Function to instrument.
+ */
+void instrumentContext(Module *M, Function &F) {
+  Type *Int32Type = Type::getInt32Ty(M->getContext());
+  std::vector<Value *> Args = {ConstantInt::get(Int32Type, getFunctionId(F))};
+
+  std::vector<Instruction *> Returns;
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+    if (isa<ReturnInst>(*I)) {
+      Returns.push_back(&*I);
+    }
+  }
+
+  auto *Enter = M->getFunction(CONTEXT_ENTER_FUNCTION_NAME);
+  CallInst::Create(Enter, Args, "", &*F.getEntryBlock().getFirstInsertionPt());
+
+  auto *Exit = M->getFunction(CONTEXT_EXIT_FUNCTION_NAME);
+  for (auto *Ret : Returns) {
+    CallInst::Create(Exit, Args, "", Ret);
+  }
 }
 
 bool Instrument::runOnFunction(Function &F) {
@@ -41,9 +114,22 @@ bool Instrument::runOnFunction(Function &F) {
 
   M->getOrInsertFunction(COVERAGE_FUNCTION_NAME, VoidType, Int32Type,
                          Int32Type);
-  M->getOrInsertFunction(SANITIZE_FUNCTION_NAME, VoidType, Int32Type, Int32Type,
+  M->getOrInsertFunction(REPORT_DIV_ZERO_FUNCTION_NAME, VoidType, Int32Type,
                          Int32Type);
+  auto *Report = M->getFunction(REPORT_DIV_ZERO_FUNCTION_NAME);
+  Report->addFnAttr(Attribute::NoReturn);
+  Report->addFnAttr(Attribute::NoInline);
+  Report->addFnAttr(Attribute::Cold);
+  Report->addFnAttr(Attribute::NoUnwind);
+  if (ContextSensitive) {
+    M->getOrInsertFunction(CONTEXT_COVERAGE_FUNCTION_NAME, VoidType, Int32Type,
+                           Int32Type);
+    M->getOrInsertFunction(CONTEXT_ENTER_FUNCTION_NAME, VoidType, Int32Type);
+    M->getOrInsertFunction(CONTEXT_EXIT_FUNCTION_NAME, VoidType, Int32Type);
+  }
 
+  // Divisions are guarded after the walk, since guarding splits blocks.
+  std::vector<std::tuple<Instruction *, int, int>> Divisions;
   for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
     if (I->getOpcode() == Instruction::PHI) {
       continue;
@@ -56,10 +142,19 @@ bool Instrument::runOnFunction(Function &F) {
     int Col = DebugLoc.getCol();
     if (I->getOpcode() == Instruction::SDiv ||
         I->getOpcode() == Instruction::UDiv) {
-      instrumentSanitize(M, *I, Line, Col);
+      Divisions.emplace_back(&*I, Line, Col);
     }
     instrumentCoverage(M, *I, Line, Col);
   }
+  for (auto &Division : Divisions) {
+    instrumentSanitize(M, *std::get<0>(Division), std::get<1>(Division),
+                       std::get<2>(Division));
+  }
+
+  // Done last so that the context hooks are not themselves covered.
+  if (ContextSensitive) {
+    instrumentContext(M, F);
+  }
   return true;
 }
 
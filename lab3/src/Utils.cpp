@@ -1,16 +1,54 @@
 #include <Utils.h>
 
+#include <csignal>
+#include <cstring>
+#include <sys/wait.h>
+
+#include "InputWriter.h"
+
 int successCount = 0;
 int failureCount = 0;
 
-void initialize(std::string &OutDir) {
+static InputWriter Writer;
+static volatile sig_atomic_t StopSignal = 0;
+
+static void handleStopSignal(int Signal) { StopSignal = Signal; }
+
+bool initialize(std::string &OutDir) {
   int Status;
   std::string SuccessDir = OutDir + "/success";
   std::string FailureDir = OutDir + "/failure";
   mkdir(SuccessDir.c_str(), 0755);
   mkdir(FailureDir.c_str(), 0755);
+
+  const char *Archive = getenv("FUZZER_ARCHIVE");
+  if (!Writer.start(OutDir, Archive && strcmp(Archive, "0") != 0))
+    return false;
+  atexit(flushInputs);
+
+  struct sigaction Action = {};
+  Action.sa_handler = handleStopSignal;
+  Action.sa_flags = SA_RESTART;
+  sigaction(SIGINT, &Action, nullptr);
+  sigaction(SIGTERM, &Action, nullptr);
+  sigaction(SIGHUP, &Action, nullptr);
+  return true;
 }
 
+bool stopRequested() { return StopSignal != 0; }
+
+bool stoppedBySignal(int Status) {
+  int Signal = 0;
+  if (WIFSIGNALED(Status))
+    Signal = WTERMSIG(Status);
+  else if (WIFEXITED(Status) && WEXITSTATUS(Status) > 128)
+    // The shell of popen reports a killed target as 128 + the signal.
+    Signal = WEXITSTATUS(Status) - 128;
+  return Signal == SIGINT || Signal == SIGTERM || Signal == SIGHUP;
+}
+
+void flushInputs() { Writer.stop(); }
+
 std::string readOneFile(std::string &Path) {
   std::ifstream SeedFile(Path);
   std::string Line((std::istreambuf_iterator<char>(SeedFile)),
@@ -55,17 +93,11 @@ void storeSeed(std::string &OutDir, int randomSeed) {
 }
 
 void storePassingInput(std::string &Input, std::string &OutDir) {
-  std::string Path = OutDir + "/success/input" + std::to_string(successCount++);
-  std::ofstream OutFile(Path);
-  OutFile << Input;
-  OutFile.close();
+  Writer.push(false, successCount++, Input);
 }
 
 void storeCrashingInput(std::string &Input, std::string &OutDir) {
-  std::string Path = OutDir + "/failure/input" + std::to_string(failureCount++);
-  std::ofstream OutFile(Path);
-  OutFile << Input;
-  OutFile.close();
+  Writer.push(true, failureCount++, Input);
 }
 
 int runTarget(std::string &Target, std::string &Input) {
@@ -0,0 +1,188 @@
+#! /usr/bin/env python3
+"""
+Fuzzer benchmark.
+
+Builds every program in this directory with the Instrument pass, fuzzes
+each one for a fixed wall-clock budget over several trials with fixed
+random seeds, and writes a JSON summary with execs/sec, coverage over
+time (distinct sites and edges of the .cov traces of all runs) and time
+to first crash, each with a 95% confidence interval.
+
+Usage: ./bench.py [--trials N] [--budget SECONDS] [--out FILE] [targets...]
+"""
+
+import argparse
+import json
+import math
+import os
+import statistics
+import subprocess
+import sys
+import time
+
+from pathlib import Path
+from typing import Dict, List, Optional
+
+TEST_DIR = Path(__file__).resolve().parent
+FUZZER = TEST_DIR.parent / "build" / "fuzzer"
+SEED_DIR = TEST_DIR / "fuzz_input"
+TARGETS = ["easy1", "easy2", "path1", "path2", "path3", "sanity1"]
+
+# Number of points of the coverage-over-time curves.
+CHECKPOINTS = 10
+
+# Two-sided 95% Student t quantiles for 1..30 degrees of freedom.
+T_95 = [
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+]
+
+
+def summarize(samples: List[float]) -> Dict[str, Optional[float]]:
+    """
+    Mean of the samples with the half width of its 95% confidence interval.
+    """
+    if not samples:
+        return {"n": 0, "mean": None, "ci95": None}
+    mean = statistics.mean(samples)
+    if len(samples) == 1:
+        return {"n": 1, "mean": mean, "ci95": None}
+    df = len(samples) - 1
+    t = T_95[df - 1] if df <= len(T_95) else 1.96
+    ci = t * statistics.stdev(samples) / math.sqrt(len(samples))
+    return {"n": len(samples), "mean": mean, "ci95": ci}
+
+
+def read_stats(path: Path) -> List[List[int]]:
+    """
+    Parse the rows "elapsed_ms, execs, crashes, sites, edges" written by
+    the fuzzer when FUZZER_STATS is set.
+    """
+    rows = []
+    with path.open() as fp:
+        for line in fp:
+            if line.startswith("#") or not line.strip():
+                continue
+            rows.append([int(field) for field in line.split(",")])
+    return rows
+
+
+def run_trial(target: str, budget: float, seed: int, freq: int) -> Dict:
+    """
+    Fuzz target once and extract the metrics of the trial.
+    """
+    out_dir = TEST_DIR / f"bench_output_{target}_{seed}"
+    stats = TEST_DIR / f"bench_output_{target}_{seed}.stats"
+    subprocess.run(["rm", "-rf", str(out_dir)], check=True)
+    out_dir.mkdir()
+
+    env = dict(os.environ, FUZZER_STATS=str(stats))
+    start = time.monotonic()
+    subprocess.run(
+        [
+            "timeout", str(budget), str(FUZZER), f"./{target}", str(SEED_DIR),
+            str(out_dir), str(freq), str(seed),
+        ],
+        cwd=TEST_DIR,
+        env=env,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+    elapsed = time.monotonic() - start
+    rows = read_stats(stats)
+
+    execs = rows[-1][1] if rows else 0
+    first_crash = next((row[0] / 1000 for row in rows if row[2] > 0), None)
+    sites, edges = [], []
+    for i in range(1, CHECKPOINTS + 1):
+        limit_ms = budget * 1000 * i / CHECKPOINTS
+        seen = [row for row in rows if row[0] <= limit_ms]
+        sites.append(seen[-1][3] if seen else 0)
+        edges.append(seen[-1][4] if seen else 0)
+    return {
+        "seed": seed,
+        "execs": execs,
+        "execs_per_sec": execs / elapsed,
+        "time_to_first_crash": first_crash,
+        "sites": sites,
+        "edges": edges,
+    }
+
+
+def bench_target(target: str, trials: int, budget: float, base_seed: int,
+                 freq: int) -> Dict:
+    results = [
+        run_trial(target, budget, base_seed + trial, freq)
+        for trial in range(trials)
+    ]
+    crash_times = [
+        r["time_to_first_crash"] for r in results
+        if r["time_to_first_crash"] is not None
+    ]
+    return {
+        "execs_per_sec": summarize([r["execs_per_sec"] for r in results]),
+        "sites_over_time": [
+            dict(time=budget * (i + 1) / CHECKPOINTS,
+                 **summarize([r["sites"][i] for r in results]))
+            for i in range(CHECKPOINTS)
+        ],
+        "edges_over_time": [
+            dict(time=budget * (i + 1) / CHECKPOINTS,
+                 **summarize([r["edges"][i] for r in results]))
+            for i in range(CHECKPOINTS)
+        ],
+        "time_to_first_crash": dict(
+            crashed_trials=len(crash_times), **summarize(crash_times)
+        ),
+        "trials": results,
+    }
+
+
+def git_revision() -> Optional[str]:
+    process = subprocess.run(
+        ["git", "rev-parse", "HEAD"], cwd=TEST_DIR, stdout=subprocess.PIPE,
+        stderr=subprocess.DEVNULL, universal_newlines=True,
+    )
+    return process.stdout.strip() if process.returncode == 0 else None
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="Benchmark the fuzzer.")
+    parser.add_argument("--trials", type=int, default=5)
+    parser.add_argument("--budget", type=float, default=10,
+                        help="wall-clock seconds per trial")
+    parser.add_argument("--seed", type=int, default=42,
+                        help="random seed of the first trial")
+    parser.add_argument("--freq", type=int, default=1000)
+    parser.add_argument("--out", default="bench.json")
+    parser.add_argument("targets", nargs="*", default=TARGETS)
+    args = parser.parse_args()
+
+    if not FUZZER.exists():
+        print(f"{FUZZER} not found, build the project first", file=sys.stderr)
+        return 1
+    subprocess.run(["make", *args.targets], cwd=TEST_DIR, check=True)
+
+    report = {
+        "revision": git_revision(),
+        "trials": args.trials,
+        "budget": args.budget,
+        "seed": args.seed,
+        "freq": args.freq,
+        "targets": {},
+    }
+    for target in args.targets:
+        print(f"Benchmarking {target}...", file=sys.stderr)
+        report["targets"][target] = bench_target(
+            target, args.trials, args.budget, args.seed, args.freq
+        )
+
+    with open(args.out, "w") as fp:
+        json.dump(report, fp, indent=4)
+    print(f"Results written to {args.out}", file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
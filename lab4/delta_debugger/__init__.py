@@ -1,6 +1,22 @@
-from typing import Union
+import re
+
+from pathlib import Path
+from typing import Tuple, Union
 from subprocess import run, PIPE
 
+BUILD_DIR = Path(__file__).resolve().parent.parent / "build"
+DDMIN = BUILD_DIR / "ddmin"
+FORK_SERVER_LIB = BUILD_DIR / "libforkserver.so"
+
+# The crash signature of a run: its return code, the line and column where
+# the sanitizer stopped it and a hash of the crash site, or 0 for what is
+# not known. See include/ForkServer.h.
+Signature = Tuple[int, int, int, int]
+
+SANITIZER_MESSAGE = re.compile(
+    rb"Divide-by-zero detected at line (\d+) and col (\d+)"
+)
+
 
 def run_target(target: str, input: Union[str, bytes]) -> int:
     """
@@ -26,3 +42,19 @@ def run_target(target: str, input: Union[str, bytes]) -> int:
     #     f"err:\n{process.stderr}"
     # )
     return process.returncode
+
+
+def run_signature(target: str, input: bytes) -> Signature:
+    """
+    Run the target program with input on its stdin. Without a fork server,
+    the sanitizer location is read from what the runtime prints, and the
+    crash site is not known.
+
+    :param target: The target program to run.
+    :param input: The input to pass to the target program.
+    :return: The crash signature of the run.
+    """
+    process = run([target], input=input, stdout=PIPE, stderr=PIPE)
+    match = SANITIZER_MESSAGE.search(process.stdout)
+    line, col = (int(match[1]), int(match[2])) if match else (0, 0)
+    return process.returncode, line, col, 0
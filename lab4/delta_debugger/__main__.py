@@ -1,5 +1,6 @@
 #! /usr/bin/env python3
 
+import codecs
 import sys
 
 from sys import argv
@@ -7,6 +8,7 @@ from pathlib import Path
 
 from delta_debugger import run_target
 from delta_debugger.delta import delta_debug
+from delta_debugger.reducer import DEFAULT_LEVELS, reduce_input
 
 
 def exist_check(file):
@@ -17,10 +19,39 @@ def exist_check(file):
 
 
 def main() -> int:
-    if len(argv) < 3:
-        print(f"usage: {argv[0]} [target] [crashing input file]")
+    """
+    usage: delta-debugger [target] [crashing input file] (--native)
+        (--hierarchical) (--boundaries=BYTES ...) (--any-crash) (--probabilistic)
+
+    Without options, the input is reduced with delta_debug of delta.py.
+    The options reduce it with reducer.py instead, which runs the native
+    engine in build/ddmin when it has been built, so --native alone picks
+    that engine. With --hierarchical, the input is reduced as lines, then as
+    whitespace-separated tokens and then as bytes. Each --boundaries gives
+    the bytes that end a unit of one coarse level instead, with escapes
+    like \\n, from the coarsest level to the finest. The reduced input
+    keeps the crash signature of the input, unless --any-crash lets it
+    crash the target in any way. With --probabilistic, the input is
+    reduced with ProbDD, which needs fewer tests than ddmin but does not
+    guarantee a 1-minimal result.
+    """
+    args = [arg for arg in argv[1:] if not arg.startswith("--")]
+    flags = [arg for arg in argv[1:] if arg.startswith("--")]
+    levels = [
+        codecs.escape_decode(flag[len("--boundaries=") :])[0]
+        for flag in flags
+        if flag.startswith("--boundaries=")
+    ]
+    if not levels and "--hierarchical" in flags:
+        levels = list(DEFAULT_LEVELS)
+    if len(args) < 2:
+        print(
+            f"usage: {argv[0]} [target] [crashing input file] (--native) "
+            f"(--hierarchical) (--boundaries=BYTES ...) (--any-crash) "
+            f"(--probabilistic)"
+        )
         return 1
-    target, input_file = argv[1], argv[2]
+    target, input_file = args[0], args[1]
     if not Path(target).exists():
         print(f"{target} not found", sys.stderr)
         return 1
@@ -37,7 +68,16 @@ def main() -> int:
             )
             return 1
 
-    delta_debugging_result = delta_debug(target=target, input=input)
+    if flags:
+        delta_debugging_result = reduce_input(
+            target=target,
+            input=input,
+            levels=levels,
+            any_crash="--any-crash" in flags,
+            probabilistic="--probabilistic" in flags,
+        )
+    else:
+        delta_debugging_result = delta_debug(target=target, input=input)
 
     print(
         f"Original Input Size: {len(input)}",
@@ -51,6 +91,7 @@ def main() -> int:
 
 if __name__ == "__main__":
     """
-    usage: delta-debug [target] [crashing input file]
+    usage: delta-debug [target] [crashing input file] (--native)
+        (--hierarchical) (--boundaries=BYTES ...) (--any-crash) (--probabilistic)
     """
-    sys.exit(main(*sys.argv[1:]))
+    sys.exit(main())
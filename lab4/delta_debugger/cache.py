@@ -0,0 +1,105 @@
+import hashlib
+import struct
+import sys
+
+from pathlib import Path
+from typing import Callable, Dict, Optional
+
+from delta_debugger import Signature, run_signature
+
+# Layout of the cache file, in host byte order: CACHE_HEADER (magic, whether
+# the records hold crash sites, the SHA-256 digest of the target), then one
+# CACHE_RECORD (SHA-256 digest of the input, crash signature) for every input
+# tested so far. Records are only ever appended. include/DDCache.h describes
+# the same layout for build/ddmin.
+CACHE_MAGIC = 0x33434444  # "DDC3"
+CACHE_EXTENSION = ".ddcache"
+CACHE_HEADER = struct.Struct("=II32s")
+CACHE_RECORD = struct.Struct("=32siiiI")
+
+
+def hash_input(input: bytes) -> bytes:
+    """
+    :return: The SHA-256 digest of input.
+    """
+    return hashlib.sha256(input).digest()
+
+
+class OutcomeCache:
+    """
+    Content-addressed cache of the crash signature of the target on every
+    input it has been tested with. The cache is kept in [target].ddcache, so it
+    carries over to later reductions with the same target. If the target
+    changes, the old outcomes no longer apply and the cache starts over. So
+    does it if it was written by a runner that knows crash sites and this
+    one does not, or the other way round.
+    """
+
+    def __init__(
+        self,
+        target: str,
+        runner: Optional[Callable[[bytes], Signature]] = None,
+        sites: bool = False,
+    ):
+        """
+        Open the cache of target, creating it if necessary.
+
+        :param target: The target program.
+        :param runner: Runs the target program on an input and returns the
+            crash signature of the run, run_signature by default.
+        :param sites: Whether runner knows the crash site of a run, as a fork
+            server does. run_signature does not.
+        """
+        self.target = target
+        self.runner = runner or (lambda input: run_signature(target, input))
+        self.path = Path(f"{target}{CACHE_EXTENSION}")
+        self.outcomes: Dict[bytes, Signature] = dict()
+        self.hits = 0
+        self.misses = 0
+
+        with open(target, "rb") as fp:
+            header = CACHE_HEADER.pack(CACHE_MAGIC, sites, hash_input(fp.read()))
+        data = self.path.read_bytes() if self.path.exists() else b""
+        if data[: CACHE_HEADER.size] != header:
+            self.path.write_bytes(header)
+            return
+        offset = CACHE_HEADER.size
+        # A record cut short by an interrupted run is dropped.
+        while offset + CACHE_RECORD.size <= len(data):
+            digest, *signature = CACHE_RECORD.unpack_from(data, offset)
+            self.outcomes[digest] = tuple(signature)
+            offset += CACHE_RECORD.size
+        if offset != len(data):
+            with open(self.path, "r+b") as fp:
+                fp.truncate(offset)
+
+    def signature(self, input: bytes) -> Signature:
+        """
+        Run the target program with input on its stdin, unless it ran with
+        the same input before.
+
+        :param input: The input to pass to the target program.
+        :return: The crash signature of the run.
+        """
+        digest = hash_input(input)
+        if digest in self.outcomes:
+            self.hits += 1
+            return self.outcomes[digest]
+        self.misses += 1
+        signature = tuple(self.runner(input))
+        self.outcomes[digest] = signature
+        with open(self.path, "ab") as fp:
+            fp.write(CACHE_RECORD.pack(digest, *signature))
+        return signature
+
+    def report(self) -> None:
+        """
+        Print the hit rate of the cache.
+        """
+        tests = self.hits + self.misses
+        rate = 100 * self.hits / tests if tests else 0
+        print(
+            f"Outcome cache: {self.hits} of {tests} tests cached ({rate:.1f}%), "
+            f"{len(self.outcomes)} inputs in {self.path}",
+            file=sys.stderr,
+        )
@@ -0,0 +1,248 @@
+import sys
+import tempfile
+
+from pathlib import Path
+from subprocess import run
+from typing import Callable, Iterator, List, Sequence, Tuple
+
+from delta_debugger import DDMIN, Signature
+from delta_debugger.cache import OutcomeCache
+from delta_debugger.forkserver import ForkServer
+
+EMPTY_STRING = b""
+
+# Prior probability of a unit to be essential in the probabilistic mode.
+# ProbDD uses 0.1, which only removes about ten units per test. Large inputs
+# start from the probability that makes PROBDD_ESSENTIAL units essential on
+# average instead, so that the first tests remove most of the input.
+PROBDD_PRIOR = 0.1
+PROBDD_ESSENTIAL = 2
+
+# Boundaries of the coarse units of the hierarchical mode: lines, then
+# whitespace-separated tokens. Bytes always come last.
+DEFAULT_LEVELS = (b"\n", b" \t\r\n")
+
+
+def split_units(input: bytes, boundaries: bytes) -> List[bytes]:
+    """
+    Split input into units that end after a boundary byte.
+
+    :param input: input to split
+    :param boundaries: the bytes that end a unit, or none to split input
+        into single bytes
+    :return: the units, which join back into input
+    """
+    if not boundaries:
+        return [input[i : i + 1] for i in range(len(input))]
+    units = list()
+    start = 0
+    for i, byte in enumerate(input):
+        if byte in boundaries:
+            units.append(input[start : i + 1])
+            start = i + 1
+    if start < len(input):
+        units.append(input[start:])
+    return units
+
+
+def candidates(units: Sequence[bytes], n: int) -> Iterator[List[bytes]]:
+    """
+    Split units into n chunks of nearly equal size.
+
+    :param units: units to split
+    :param n: number of chunks, at most len(units)
+    :return: the chunks in order, followed by their complements unless
+        n is 2, where the complements are the chunks themselves.
+    """
+    bounds = [len(units) * i // n for i in range(n + 1)]
+    for i in range(n):
+        yield list(units[bounds[i] : bounds[i + 1]])
+    if n == 2:
+        return
+    for i in range(n):
+        yield list(units[: bounds[i]]) + list(units[bounds[i + 1] :])
+
+
+def next_input(
+    test: Callable[[bytes], bool], units: List[bytes], n: int
+) -> Tuple[List[bytes], int]:
+    """
+    One round of ddmin: test the chunks of units, then their complements,
+    and reduce to the first one that still crashes the target.
+
+    :param test: tells whether an input still crashes the target
+    :param units: units of the crashing input of the round
+    :param n: granularity of the round
+    :return: the next units and n to try. The units are the same object
+        as the given ones if no candidate crashed.
+    """
+    for index, candidate in enumerate(candidates(units, n)):
+        if test(EMPTY_STRING.join(candidate)):
+            if index < n:
+                return candidate, 2
+            return candidate, max(n - 1, 2)
+    return units, min(2 * n, len(units))
+
+
+def ddmin(test: Callable[[bytes], bool], units: List[bytes]) -> List[bytes]:
+    """
+    Reduce the units of a crashing input to a 1-minimal set of units.
+
+    :param test: tells whether an input still crashes the target
+    :param units: units of the crashing input
+    :return: the units that are left
+    """
+    n = 2
+    while len(units) >= 2:
+        reduced, n_next = next_input(test, units, n)
+        if reduced is units and n >= len(units):
+            break
+        units, n = reduced, n_next
+    return units
+
+
+def probdd(test: Callable[[bytes], bool], units: List[bytes]) -> List[bytes]:
+    """
+    Reduce the units of a crashing input with probabilistic delta debugging
+    (ProbDD). Every unit has a probability of being essential to the crash.
+    Each step removes the units with the lowest probabilities, as many as
+    maximize the expected number of units removed, and tests the rest. If
+    it still crashes, the units are gone for good; otherwise the chance
+    that one of them is essential grows, so they are less likely to be
+    removed together again. A unit is kept once it is known to be
+    essential on its own. The result is not always 1-minimal, but takes
+    far fewer tests than ddmin does when few units matter.
+
+    :param test: tells whether an input still crashes the target
+    :param units: units of the crashing input
+    :return: the units that are left
+    """
+    prior = min(PROBDD_PRIOR, PROBDD_ESSENTIAL / max(len(units), 1))
+    probabilities = [prior] * len(units)
+    while True:
+        order = sorted(
+            (i for i in range(len(units)) if probabilities[i] < 1),
+            key=lambda i: probabilities[i],
+        )
+        if not order:
+            return units
+        # The expected gain of removing the first k units of order is k
+        # times the probability that none of them is essential.
+        size, best_gain, survival = 0, 0.0, 1.0
+        for k, i in enumerate(order, 1):
+            survival *= 1 - probabilities[i]
+            if k * survival > best_gain:
+                size, best_gain = k, k * survival
+        removed = set(order[:size])
+        kept = [i for i in range(len(units)) if i not in removed]
+        if test(EMPTY_STRING.join(units[i] for i in kept)):
+            units = [units[i] for i in kept]
+            probabilities = [probabilities[i] for i in kept]
+            continue
+        # Bayes: one of the removed units is essential.
+        survival = 1.0
+        for i in removed:
+            survival *= 1 - probabilities[i]
+        for i in removed:
+            probabilities[i] = 1 if size == 1 else probabilities[i] / (1 - survival)
+
+
+def native_delta_debug(
+    target: str, input: bytes, levels: Sequence[bytes] = (), any_crash: bool = False
+) -> bytes:
+    """
+    Run ddmin with the native engine, which tests the candidates of every
+    round in parallel and gives the same result as ddmin.
+
+    :param target: target program
+    :param input: crashing input to be minimized
+    :param levels: boundaries of the coarse units, as in reduce_input
+    :param any_crash: as in reduce_input
+    :return: 1-minimal crashing input.
+    """
+    with tempfile.TemporaryDirectory() as temp_dir:
+        input_file = Path(temp_dir) / "input"
+        input_file.write_bytes(input)
+        output_file = Path(temp_dir) / "input.delta"
+        flags = [flag for level in levels for flag in ("-b", level)]
+        if any_crash:
+            flags.append("-a")
+        process = run(
+            [str(DDMIN), *flags, target, str(input_file), str(output_file)]
+        )
+        if process.returncode != 0:
+            raise RuntimeError(f"{DDMIN} failed with return code {process.returncode}")
+        return output_file.read_bytes()
+
+
+def format_signature(signature: Signature) -> str:
+    """
+    :return: The crash signature as build/ddmin prints it.
+    """
+    return_code, line, col, site = signature
+    return f"return code {return_code}, line {line}, col {col}, site {site:08x}"
+
+
+def reduce_input(
+    target: str,
+    input: bytes,
+    levels: Sequence[bytes] = (),
+    any_crash: bool = False,
+    probabilistic: bool = False,
+) -> bytes:
+    """
+    Delta debugging with crash signatures, coarse units, an outcome cache
+    and a fork server, for the options of delta-debugger beyond the plain
+    delta_debug of delta.py.
+
+    A candidate only counts as crashing if it reproduces the crash
+    signature of the input: the same return code, sanitizer location and
+    crash site. Otherwise reductions slide into other crashes of the
+    target. With any_crash, every non-zero return code counts.
+
+    With levels, the input is reduced hierarchically: first as units that
+    end at the boundaries of the first level, then as units of the next
+    level inside what remains, and at last as single bytes. Coarse units
+    take out large parts of the input in few tests, so the byte level only
+    has to clean up.
+
+    With probabilistic, every level is reduced with probdd instead of
+    ddmin, which tests one candidate at a time.
+
+    Uses the native engine in build/ddmin for ddmin when it has been built,
+    and tests the candidates one after another otherwise. Both look up every
+    candidate in the outcome cache of the target before running it, and
+    run the target through a fork server if it can have one.
+
+    :param target: target program
+    :param input: crashing input to be minimized
+    :param levels: the bytes that end a unit at each coarse level
+    :param any_crash: whether any crash will do
+    :param probabilistic: whether to reduce with probdd
+    :return: 1-minimal crashing input, or a small one with probabilistic.
+    """
+    if DDMIN.exists() and not probabilistic:
+        return native_delta_debug(target, input, levels, any_crash)
+
+    with ForkServer(target) as server:
+        if server.alive:
+            cache = OutcomeCache(target, server.run, sites=True)
+        else:
+            cache = OutcomeCache(target)
+        expected = cache.signature(input)
+        print(f"Crash signature: {format_signature(expected)}", file=sys.stderr)
+
+        def test(candidate: bytes) -> bool:
+            signature = cache.signature(candidate)
+            return signature[0] != 0 if any_crash else signature == expected
+
+        for level, boundaries in enumerate([*levels, EMPTY_STRING], 1):
+            units = split_units(input, boundaries)
+            reduced = (probdd if probabilistic else ddmin)(test, units)
+            print(
+                f"Reduced {len(units)} to {len(reduced)} units of level {level}",
+                file=sys.stderr,
+            )
+            input = EMPTY_STRING.join(reduced)
+    cache.report()
+    return input
@@ -0,0 +1,37 @@
+#ifndef DD_CACHE_H
+#define DD_CACHE_H
+
+#include <stdint.h>
+
+/**
+ * Outcome cache of the delta debugger, kept in <target>.ddcache.
+ *
+ * The file holds one dd_cache_header followed by one dd_cache_record for
+ * every input the target has been tested with, in host byte order. A record
+ * holds the crash signature of the run, as in fork_server_status. Records
+ * are only ever appended. Inputs are identified by their SHA-256 digest, and
+ * the header holds the digest of the target, so that the outcomes of a
+ * rebuilt target are thrown away. Only a fork server knows the crash site of
+ * a run, so the header also tells whether the records have one, and a cache
+ * written by the other kind of runner is thrown away as well.
+ * delta_debugger/cache.py reads and writes the same file.
+ */
+#define DD_CACHE_MAGIC 0x33434444 /* "DDC3" */
+#define DD_CACHE_EXTENSION ".ddcache"
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  /* 1 if the records hold crash sites, 0 if their site is always 0. */
+  uint32_t sites;
+  uint8_t target[32];
+} dd_cache_header;
+
+typedef struct __attribute__((packed)) {
+  uint8_t input[32];
+  int32_t return_code;
+  int32_t line;
+  int32_t col;
+  uint32_t site;
+} dd_cache_record;
+
+#endif // DD_CACHE_H
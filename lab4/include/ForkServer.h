@@ -0,0 +1,39 @@
+#ifndef FORK_SERVER_H
+#define FORK_SERVER_H
+
+#include <stdint.h>
+
+/**
+ * Fork server protocol between a reducer and an instrumented target.
+ *
+ * The reducer starts the target once with FORK_SERVER_ENV set to
+ * "<control fd> <status fd> <input path>". Before main, the runtime writes
+ * FORK_SERVER_HELLO to the status fd and then parks: for every request,
+ * one uint32_t read from the control fd, it forks a child that runs main
+ * with the input file on its stdin, writes the pid of the child to the
+ * status fd as an int32_t and, once the child is done, a
+ * fork_server_status. The reducer rewrites the input file, which should be
+ * on a tmpfs like /dev/shm, before each request, and signals the pid to
+ * cancel a run. The server exits when the control fd is closed.
+ *
+ * return_code is the one of the target as subprocess reports it: the exit
+ * status, or the negated signal that killed the target. line and col are
+ * where __sanitize__ stopped the child, or 0 if it did not. site is a hash
+ * of the base name of the module and the offset in it of the instruction a
+ * fatal signal stopped the child at, or 0 if none did. Together they are
+ * the crash signature of the run. Without a fork server, the reducer does
+ * not know the crash site, and site is always 0.
+ * delta_debugger/forkserver.py and build/ddmin drive the server, which
+ * lib/forkserver.c adds to targets through LD_PRELOAD.
+ */
+#define FORK_SERVER_ENV "FORK_SERVER"
+#define FORK_SERVER_HELLO 0x32535246 /* "FRS2" */
+
+typedef struct {
+  int32_t return_code;
+  int32_t line;
+  int32_t col;
+  uint32_t site;
+} fork_server_status;
+
+#endif // FORK_SERVER_H
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ucontext.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ForkServer.h"
+
+/*
+ * Fork server, see ForkServer.h.
+ *
+ * The runtime of this lab is only available prebuilt, so the server comes
+ * as a library of its own that the reducer preloads into the target. It
+ * runs as a constructor, so a child that returns from it goes on to main
+ * as if the target had just started. The crash signature of a child is
+ * left on a page it shares with the server. __sanitize__ of the preloaded
+ * library takes precedence over the one of the runtime: it records the
+ * location it stops a child at, and then calls the one of the runtime.
+ * Fatal signals record the crash site, unless the target installs handlers
+ * of its own.
+ */
+static fork_server_status *signature = NULL;
+
+/* The address ranges of the modules loaded at startup, with the load
+ * address that offsets in the module are relative to and a hash of the
+ * base name of the module. */
+#define MAX_MODULES 64
+
+typedef struct {
+  uintptr_t base;
+  uintptr_t start;
+  uintptr_t end;
+  uint32_t name;
+} module_range;
+
+static module_range modules[MAX_MODULES];
+static size_t num_modules = 0;
+
+/* FNV-1a */
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static int add_module(struct dl_phdr_info *info,
+                      size_t size __attribute__((unused)),
+                      void *data __attribute__((unused))) {
+  if (num_modules == MAX_MODULES) {
+    return 1;
+  }
+  module_range *module = &modules[num_modules];
+  module->base = info->dlpi_addr;
+  module->start = UINTPTR_MAX;
+  module->end = 0;
+  for (size_t i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr) *header = &info->dlpi_phdr[i];
+    if (header->p_type != PT_LOAD) {
+      continue;
+    }
+    uintptr_t start = info->dlpi_addr + header->p_vaddr;
+    if (start < module->start) {
+      module->start = start;
+    }
+    if (start + header->p_memsz > module->end) {
+      module->end = start + header->p_memsz;
+    }
+  }
+  /* The main program has an empty name, and the path of a library depends
+   * on how it was found, so only its base name counts. */
+  const char *name = info->dlpi_name ? info->dlpi_name : "";
+  const char *slash = strrchr(name, '/');
+  name = slash ? slash + 1 : name;
+  module->name = hash_bytes(2166136261u, name, strlen(name));
+  if (module->start < module->end) {
+    ++num_modules;
+  }
+  return 0;
+}
+
+/* Record a hash of the module and offset of the instruction the signal
+ * stopped the child at, which does not change with the load address or
+ * with the path the target was started by. The modules are looked up in
+ * the table the server filled in before forking, as dladdr is not
+ * async-signal-safe. An instruction outside of them only counts as an
+ * unknown site. The handler is reset before it runs, so the instruction
+ * faults again once it returns, or abort raises the signal again, and the
+ * child dies as it would have. */
+static void record_crash_site(int sig __attribute__((unused)),
+                              siginfo_t *info __attribute__((unused)),
+                              void *context) {
+  uintptr_t pc = 0;
+#if defined(__x86_64__)
+  pc = ((ucontext_t *)context)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+  pc = ((ucontext_t *)context)->uc_mcontext.pc;
+#endif
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < num_modules; ++i) {
+    if (modules[i].start <= pc && pc < modules[i].end) {
+      uintptr_t offset = pc - modules[i].base;
+      hash = hash_bytes(modules[i].name, &offset, sizeof(offset));
+      break;
+    }
+  }
+  signature->site = hash ? hash : 1;
+}
+
+static void init_crash_sites(void) {
+  int fatal_signals[] = {SIGFPE, SIGSEGV, SIGBUS, SIGILL, SIGABRT};
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = record_crash_site;
+  action.sa_flags = SA_SIGINFO | SA_RESETHAND;
+  for (size_t i = 0; i < sizeof(fatal_signals) / sizeof(int); ++i) {
+    sigaction(fatal_signals[i], &action, NULL);
+  }
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+  const char *bytes = data;
+  while (size > 0) {
+    ssize_t written = write(fd, bytes, size);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return -1;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return 0;
+}
+
+__attribute__((constructor)) static void fork_server(void) {
+  const char *config = getenv(FORK_SERVER_ENV);
+  int control_fd, status_fd, offset;
+  if (config == NULL ||
+      sscanf(config, "%d %d %n", &control_fd, &status_fd, &offset) != 2) {
+    return;
+  }
+  int input_fd = open(config + offset, O_RDONLY);
+  unsetenv(FORK_SERVER_ENV);
+  signature = mmap(NULL, sizeof(fork_server_status), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  uint32_t hello = FORK_SERVER_HELLO;
+  if (input_fd == -1 || signature == MAP_FAILED ||
+      write_all(status_fd, &hello, sizeof(hello))) {
+    _exit(1);
+  }
+
+  dl_iterate_phdr(add_module, NULL);
+
+  uint32_t request;
+  pid_t child = 0;
+  while (read(control_fd, &request, sizeof(request)) == sizeof(request)) {
+    /* The last child stays a zombie until the next request, so that its
+     * pid is not reused while the reducer may still cancel it. */
+    if (child) {
+      waitpid(child, NULL, 0);
+    }
+    memset(signature, 0, sizeof(*signature));
+    lseek(input_fd, 0, SEEK_SET);
+    child = fork();
+    if (child == -1) {
+      _exit(1);
+    }
+    if (child == 0) {
+      close(control_fd);
+      close(status_fd);
+      dup2(input_fd, 0);
+      close(input_fd);
+      init_crash_sites();
+      return;
+    }
+
+    int32_t pid = child;
+    siginfo_t info;
+    if (write_all(status_fd, &pid, sizeof(pid))) {
+      _exit(1);
+    }
+    while (waitid(P_PID, child, &info, WEXITED | WNOWAIT) == -1 &&
+           errno == EINTR) {
+    }
+    fork_server_status status = *signature;
+    status.return_code =
+        info.si_code == CLD_EXITED ? info.si_status : -info.si_status;
+    if (write_all(status_fd, &status, sizeof(status))) {
+      _exit(1);
+    }
+  }
+  if (child) {
+    waitpid(child, NULL, 0);
+  }
+  _exit(0);
+}
+
+void __sanitize__(int divisor, int line, int col) {
+  static void (*runtime_sanitize)(int, int, int) = NULL;
+  if (runtime_sanitize == NULL) {
+    runtime_sanitize = dlsym(RTLD_NEXT, "__sanitize__");
+  }
+  if (divisor == 0 && signature != NULL) {
+    signature->line = line;
+    signature->col = col;
+  }
+  if (runtime_sanitize != NULL) {
+    runtime_sanitize(divisor, line, col);
+  } else if (divisor == 0) {
+    printf("Divide-by-zero detected at line %d and col %d\n", line, col);
+    exit(1);
+  }
+}
@@ -0,0 +1,890 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <spawn.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "DDCache.h"
+#include "ForkServer.h"
+
+extern char **environ;
+
+/**
+ * @brief Compute the SHA-256 digest of Data, as in FIPS 180-4.
+ *
+ * @return std::string The 32 bytes of the digest.
+ */
+std::string sha256(const std::string &Data) {
+  static const uint32_t K[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+      0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+      0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+      0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+      0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+      0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+      0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+      0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+      0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+  uint32_t H[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  auto Rotate = [](uint32_t X, int N) { return (X >> N) | (X << (32 - N)); };
+
+  // Pad to a multiple of 64 bytes with a 1 bit, zeros and the bit length.
+  std::string Message = Data;
+  Message.push_back('\x80');
+  while (Message.size() % 64 != 56) {
+    Message.push_back(0);
+  }
+  uint64_t Bits = uint64_t(Data.size()) * 8;
+  for (int I = 7; I >= 0; --I) {
+    Message.push_back(char(Bits >> (I * 8)));
+  }
+
+  for (size_t Block = 0; Block < Message.size(); Block += 64) {
+    uint32_t W[64];
+    for (int I = 0; I < 16; ++I) {
+      const unsigned char *P =
+          reinterpret_cast<const unsigned char *>(&Message[Block + I * 4]);
+      W[I] = uint32_t(P[0]) << 24 | uint32_t(P[1]) << 16 |
+             uint32_t(P[2]) << 8 | P[3];
+    }
+    for (int I = 16; I < 64; ++I) {
+      uint32_t S0 = Rotate(W[I - 15], 7) ^ Rotate(W[I - 15], 18) ^
+                    (W[I - 15] >> 3);
+      uint32_t S1 = Rotate(W[I - 2], 17) ^ Rotate(W[I - 2], 19) ^
+                    (W[I - 2] >> 10);
+      W[I] = W[I - 16] + S0 + W[I - 7] + S1;
+    }
+    uint32_t A = H[0], B = H[1], C = H[2], D = H[3], E = H[4], F = H[5],
+             G = H[6], X = H[7];
+    for (int I = 0; I < 64; ++I) {
+      uint32_t S1 = Rotate(E, 6) ^ Rotate(E, 11) ^ Rotate(E, 25);
+      uint32_t T1 = X + S1 + ((E & F) ^ (~E & G)) + K[I] + W[I];
+      uint32_t S0 = Rotate(A, 2) ^ Rotate(A, 13) ^ Rotate(A, 22);
+      uint32_t T2 = S0 + ((A & B) ^ (A & C) ^ (B & C));
+      X = G;
+      G = F;
+      F = E;
+      E = D + T1;
+      D = C;
+      C = B;
+      B = A;
+      A = T1 + T2;
+    }
+    H[0] += A;
+    H[1] += B;
+    H[2] += C;
+    H[3] += D;
+    H[4] += E;
+    H[5] += F;
+    H[6] += G;
+    H[7] += X;
+  }
+
+  std::string Digest;
+  for (uint32_t Word : H) {
+    for (int I = 3; I >= 0; --I) {
+      Digest.push_back(char(Word >> (I * 8)));
+    }
+  }
+  return Digest;
+}
+
+/// The crash signature of a run, see ForkServer.h.
+using Signature = fork_server_status;
+
+bool sameSignature(const Signature &A, const Signature &B) {
+  return A.return_code == B.return_code && A.line == B.line &&
+         A.col == B.col && A.site == B.site;
+}
+
+/**
+ * The crash signature of the target on every input it has been tested with,
+ * kept in <target>.ddcache across runs of the delta debugger.
+ */
+class OutcomeCache {
+public:
+  /**
+   * @brief Read the cache of Target, or start a new one if there is none, if
+   * it belongs to an older build of Target or if it was written by a runner
+   * that does (Sites) or does not know crash sites, unlike this one.
+   *
+   * @return int 0 on success.
+   */
+  int open(const std::string &Target, const std::string &TargetData,
+           bool Sites);
+
+  /**
+   * @brief Look up the crash signature of the target on the input with
+   * Digest.
+   *
+   * @return bool True if the input has been tested before.
+   */
+  bool lookup(const std::string &Digest, Signature &Result);
+
+  /**
+   * @brief Record the crash signature of the target on the input with Digest.
+   */
+  void insert(const std::string &Digest, const Signature &Result);
+
+  /**
+   * @brief Print the hit rate of the cache, given the number of Runs of the
+   * target.
+   */
+  void report(size_t Runs) const;
+
+  size_t Hits = 0;
+
+private:
+  std::string Path;
+  FILE *File = NULL;
+  std::mutex Lock;
+  std::unordered_map<std::string, Signature> Outcomes;
+};
+
+int OutcomeCache::open(const std::string &Target,
+                       const std::string &TargetData, bool Sites) {
+  Path = Target + DD_CACHE_EXTENSION;
+  dd_cache_header Header;
+  Header.magic = DD_CACHE_MAGIC;
+  Header.sites = Sites;
+  std::string TargetDigest = sha256(TargetData);
+  memcpy(Header.target, TargetDigest.data(), sizeof(Header.target));
+
+  File = fopen(Path.c_str(), "r+b");
+  dd_cache_header Found;
+  if (File != NULL && fread(&Found, sizeof(Found), 1, File) == 1 &&
+      !memcmp(&Found, &Header, sizeof(Header))) {
+    dd_cache_record Record;
+    long Size = sizeof(Header);
+    while (fread(&Record, sizeof(Record), 1, File) == 1) {
+      Outcomes[std::string(reinterpret_cast<char *>(Record.input),
+                           sizeof(Record.input))] = {
+          Record.return_code, Record.line, Record.col, Record.site};
+      Size += sizeof(Record);
+    }
+    // A record cut short by an interrupted run is dropped.
+    if (ftruncate(fileno(File), Size) || fseek(File, Size, SEEK_SET)) {
+      fclose(File);
+      File = NULL;
+    }
+  } else {
+    if (File != NULL) {
+      fclose(File);
+    }
+    File = fopen(Path.c_str(), "wb");
+    if (File != NULL && fwrite(&Header, sizeof(Header), 1, File) != 1) {
+      fclose(File);
+      File = NULL;
+    }
+  }
+  if (File == NULL) {
+    fprintf(stderr, "Cannot write %s\n", Path.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+bool OutcomeCache::lookup(const std::string &Digest, Signature &Result) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto It = Outcomes.find(Digest);
+  if (It == Outcomes.end()) {
+    return false;
+  }
+  Result = It->second;
+  ++Hits;
+  return true;
+}
+
+void OutcomeCache::insert(const std::string &Digest, const Signature &Result) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  if (!Outcomes.emplace(Digest, Result).second) {
+    return;
+  }
+  dd_cache_record Record;
+  memcpy(Record.input, Digest.data(), sizeof(Record.input));
+  Record.return_code = Result.return_code;
+  Record.line = Result.line;
+  Record.col = Result.col;
+  Record.site = Result.site;
+  fwrite(&Record, sizeof(Record), 1, File);
+  fflush(File);
+}
+
+void OutcomeCache::report(size_t Runs) const {
+  size_t Tests = Hits + Runs;
+  fprintf(stderr,
+          "Outcome cache: %zu of %zu tests cached (%.1f%%), %zu inputs in "
+          "%s\n",
+          Hits, Tests, Tests ? 100.0 * Hits / Tests : 0.0, Outcomes.size(),
+          Path.c_str());
+}
+
+/**
+ * @brief Read the contents of the file at Path into Data.
+ *
+ * @return int 0 on success.
+ */
+int readFile(const std::string &Path, std::string &Data) {
+  FILE *In = fopen(Path.c_str(), "rb");
+  if (In == NULL) {
+    fprintf(stderr, "%s not found\n", Path.c_str());
+    return 1;
+  }
+  char Buffer[4096];
+  for (size_t Size; (Size = fread(Buffer, 1, sizeof(Buffer), In)) > 0;) {
+    Data.append(Buffer, Size);
+  }
+  fclose(In);
+  return 0;
+}
+
+/// The process a worker is running, so that other workers can cancel it.
+struct Slot {
+  std::mutex Lock;
+  pid_t Pid = 0;
+  size_t Index = 0;
+
+  /// The fork server of the worker, if the target can have one.
+  bool Started = false;
+  pid_t Server = 0;
+  int ControlFd = -1;
+  int StatusFd = -1;
+};
+
+/// The fds a fork server reads requests from and writes its status to.
+static const int ServerControlFd = 198;
+static const int ServerStatusFd = 199;
+
+/**
+ * @brief Read exactly Size bytes from Fd into Data.
+ *
+ * @return bool False if Fd was closed first.
+ */
+bool readAll(int Fd, void *Data, size_t Size) {
+  char *Bytes = static_cast<char *>(Data);
+  while (Size > 0) {
+    ssize_t Read = read(Fd, Bytes, Size);
+    if (Read == -1 && errno == EINTR) {
+      continue;
+    }
+    if (Read <= 0) {
+      return false;
+    }
+    Bytes += Read;
+    Size -= Read;
+  }
+  return true;
+}
+
+/**
+ * Tests the candidates of a round on a pool of workers. Every worker looks
+ * up one candidate at a time in the cache, and otherwise runs the target
+ * with the candidate in a file of its own on stdin. Workers run the target
+ * through a fork server of their own when the target can have one, see
+ * ForkServer.h, and start a process for every run otherwise. A candidate
+ * fails if it reproduces the expected crash signature.
+ */
+class Tester {
+public:
+  /**
+   * @param TempDir The directory of the input files, which the tester
+   * removes when it is done.
+   * @param Preload A library to preload into the target, or an empty string.
+   */
+  Tester(const std::string &Target, const std::string &TempDir, unsigned Jobs,
+         OutcomeCache &Cache, const std::string &Preload)
+      : Target(Target), TempDir(TempDir), Preload(Preload), Slots(Jobs),
+        Cache(Cache) {}
+  ~Tester();
+
+  /**
+   * @brief Start the fork server of the first worker. If it starts, the
+   * other workers start one as well, and runs know their crash site.
+   * Otherwise every worker starts a process for every run.
+   *
+   * @return bool True if the target can have a fork server.
+   */
+  bool startServers();
+
+  /**
+   * @brief Run the target on Input, unless it is in the cache.
+   *
+   * @return Signature The crash signature of the run.
+   */
+  Signature signature(const std::string &Input);
+
+  /**
+   * @brief Make the candidates that reproduce Expected fail, or with
+   * AnyCrash, the ones that crash the target in any way.
+   */
+  void expect(const Signature &Expected, bool AnyCrash) {
+    this->Expected = Expected;
+    this->AnyCrash = AnyCrash;
+  }
+
+  /**
+   * @brief Test the inputs Candidate builds for the indices up to
+   * NumCandidates in parallel. Once a candidate crashes the target,
+   * the candidates after it are cancelled, but the ones before it still
+   * run, so the result is the one of testing them in order.
+   *
+   * @return size_t The index of the first failing candidate, or the number
+   * of candidates if none fails.
+   */
+  size_t firstFailing(size_t NumCandidates,
+                      const std::function<std::string(size_t)> &Candidate);
+
+  /// The number of times the target has run.
+  std::atomic<size_t> NumTests{0};
+
+private:
+  std::string inputPath(size_t Worker) const {
+    return TempDir + "/worker" + std::to_string(Worker);
+  }
+  bool fails(const Signature &Result) const {
+    return AnyCrash ? Result.return_code != 0
+                    : sameSignature(Result, Expected);
+  }
+  bool run(const std::string &Input, const std::string &InputPath,
+           Slot &S, size_t Index, Signature &Result);
+  bool spawn(const std::string &InputPath, Slot &S, size_t Index,
+             Signature &Result);
+  void startServer(const std::string &InputPath, Slot &S);
+  bool runServer(Slot &S, size_t Index, Signature &Result);
+  void cancelAfter(size_t Index);
+
+  const std::string Target;
+  const std::string TempDir;
+  const std::string Preload;
+  std::vector<Slot> Slots;
+  OutcomeCache &Cache;
+  std::atomic<size_t> Failing{0};
+  bool Sites = false;
+  Signature Expected = {};
+  bool AnyCrash = true;
+};
+
+Tester::~Tester() {
+  for (size_t I = 0; I < Slots.size(); ++I) {
+    if (Slots[I].Server) {
+      // The server exits once its control fd is closed.
+      close(Slots[I].ControlFd);
+      close(Slots[I].StatusFd);
+      waitpid(Slots[I].Server, NULL, 0);
+    }
+    unlink(inputPath(I).c_str());
+    unlink((inputPath(I) + ".out").c_str());
+  }
+  rmdir(TempDir.c_str());
+}
+
+bool Tester::startServers() {
+  // The server opens the input file as it starts.
+  FILE *File = fopen(inputPath(0).c_str(), "wb");
+  if (File == NULL || fclose(File)) {
+    fprintf(stderr, "Cannot write %s\n", inputPath(0).c_str());
+    exit(1);
+  }
+  Slots[0].Started = true;
+  startServer(inputPath(0), Slots[0]);
+  Sites = Slots[0].Server != 0;
+  return Sites;
+}
+
+Signature Tester::signature(const std::string &Input) {
+  Failing = 1;
+  Signature Result = {};
+  run(Input, inputPath(0), Slots[0], 0, Result);
+  return Result;
+}
+
+/**
+ * @brief Run the target on Input, unless it is in the cache or a candidate
+ * before Index is already known to fail.
+ *
+ * @return bool False if the run was cancelled.
+ */
+bool Tester::run(const std::string &Input, const std::string &InputPath,
+                 Slot &S, size_t Index, Signature &Result) {
+  std::string Digest = sha256(Input);
+  if (Cache.lookup(Digest, Result)) {
+    return true;
+  }
+
+  // The file is rewritten in place, so that a fork server keeps reading
+  // from it.
+  FILE *File = fopen(InputPath.c_str(), "wb");
+  if (File == NULL ||
+      fwrite(Input.data(), 1, Input.size(), File) != Input.size() ||
+      fclose(File)) {
+    fprintf(stderr, "Cannot write %s\n", InputPath.c_str());
+    exit(1);
+  }
+  // Every worker runs the target the way the first one does, so that all
+  // outcomes in the cache have a crash site or none has.
+  if (!S.Started && Sites) {
+    S.Started = true;
+    startServer(InputPath, S);
+    if (!S.Server) {
+      fprintf(stderr, "Cannot start the fork server of %s\n", Target.c_str());
+      exit(1);
+    }
+  }
+  if (!(S.Server ? runServer(S, Index, Result)
+                 : spawn(InputPath, S, Index, Result))) {
+    return false;
+  }
+
+  // A cancelled target was killed before it could finish, so its outcome
+  // is unknown.
+  if (Index > Failing) {
+    return false;
+  }
+  Cache.insert(Digest, Result);
+  return true;
+}
+
+/**
+ * @brief Start a process of the target with its stdin at InputPath.
+ * Return codes are the ones of run_target, which are negative for signals.
+ * The sanitizer location is read from what the runtime prints, and the
+ * crash site is not known.
+ *
+ * @return bool False if the run was cancelled before it started.
+ */
+bool Tester::spawn(const std::string &InputPath, Slot &S, size_t Index,
+                   Signature &Result) {
+  std::string OutputPath = InputPath + ".out";
+  char *Argv[] = {const_cast<char *>(Target.c_str()), NULL};
+  posix_spawn_file_actions_t Actions;
+  posix_spawn_file_actions_init(&Actions);
+  posix_spawn_file_actions_addopen(&Actions, 0, InputPath.c_str(), O_RDONLY,
+                                   0);
+  posix_spawn_file_actions_addopen(&Actions, 1, OutputPath.c_str(),
+                                   O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  posix_spawn_file_actions_addopen(&Actions, 2, "/dev/null", O_WRONLY, 0);
+  pid_t Pid;
+  int Error;
+  {
+    std::lock_guard<std::mutex> Guard(S.Lock);
+    if (Index > Failing) {
+      posix_spawn_file_actions_destroy(&Actions);
+      return false;
+    }
+    Error = posix_spawn(&Pid, Target.c_str(), &Actions, NULL, Argv, environ);
+    if (!Error) {
+      S.Pid = Pid;
+      S.Index = Index;
+    }
+  }
+  posix_spawn_file_actions_destroy(&Actions);
+  if (Error) {
+    fprintf(stderr, "Cannot run %s: %s\n", Target.c_str(), strerror(Error));
+    exit(1);
+  }
+  ++NumTests;
+
+  // Wait for the target without reaping it, so that its pid cannot be
+  // reused while another worker may still cancel it.
+  siginfo_t Info;
+  while (waitid(P_PID, Pid, &Info, WEXITED | WNOWAIT) == -1 &&
+         errno == EINTR) {
+  }
+  {
+    std::lock_guard<std::mutex> Guard(S.Lock);
+    S.Pid = 0;
+  }
+  int Status;
+  waitpid(Pid, &Status, 0);
+  Result = {};
+  Result.return_code =
+      WIFEXITED(Status) ? WEXITSTATUS(Status) : -WTERMSIG(Status);
+  std::string Output;
+  readFile(OutputPath, Output);
+  size_t Message = Output.find("Divide-by-zero detected at line");
+  if (Message != std::string::npos) {
+    sscanf(Output.c_str() + Message,
+           "Divide-by-zero detected at line %d and col %d", &Result.line,
+           &Result.col);
+  }
+  return true;
+}
+
+/**
+ * @brief Start the fork server of S on InputPath. If the target does not
+ * say hello, it cannot have one, and S starts a process for every run.
+ */
+void Tester::startServer(const std::string &InputPath, Slot &S) {
+  int Control[2], Status[2];
+  if (pipe2(Control, O_CLOEXEC)) {
+    return;
+  }
+  if (pipe2(Status, O_CLOEXEC)) {
+    close(Control[0]);
+    close(Control[1]);
+    return;
+  }
+
+  std::string Preloads = Preload;
+  std::vector<std::string> Env;
+  for (char **Var = environ; *Var != NULL; ++Var) {
+    if (!strncmp(*Var, "LD_PRELOAD=", strlen("LD_PRELOAD="))) {
+      Preloads += std::string(Preloads.empty() ? "" : " ") +
+                  (*Var + strlen("LD_PRELOAD="));
+    } else if (strncmp(*Var, FORK_SERVER_ENV "=",
+                       strlen(FORK_SERVER_ENV) + 1)) {
+      Env.push_back(*Var);
+    }
+  }
+  if (!Preloads.empty()) {
+    Env.push_back("LD_PRELOAD=" + Preloads);
+  }
+  Env.push_back(std::string(FORK_SERVER_ENV "=") +
+                std::to_string(ServerControlFd) + " " +
+                std::to_string(ServerStatusFd) + " " + InputPath);
+  std::vector<char *> Envp;
+  for (auto &Var : Env) {
+    Envp.push_back(&Var[0]);
+  }
+  Envp.push_back(NULL);
+  char *Argv[] = {const_cast<char *>(Target.c_str()), NULL};
+
+  posix_spawn_file_actions_t Actions;
+  posix_spawn_file_actions_init(&Actions);
+  posix_spawn_file_actions_adddup2(&Actions, Control[0], ServerControlFd);
+  posix_spawn_file_actions_adddup2(&Actions, Status[1], ServerStatusFd);
+  posix_spawn_file_actions_addopen(&Actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&Actions, 1, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_addopen(&Actions, 2, "/dev/null", O_WRONLY, 0);
+  pid_t Pid;
+  int Error = posix_spawn(&Pid, Target.c_str(), &Actions, NULL, Argv,
+                          Envp.data());
+  posix_spawn_file_actions_destroy(&Actions);
+  close(Control[0]);
+  close(Status[1]);
+
+  uint32_t Hello = 0;
+  if (!Error && readAll(Status[0], &Hello, sizeof(Hello)) &&
+      Hello == FORK_SERVER_HELLO) {
+    S.Server = Pid;
+    S.ControlFd = Control[1];
+    S.StatusFd = Status[0];
+    return;
+  }
+  // Without a fork server, the target ran main instead.
+  close(Control[1]);
+  close(Status[0]);
+  if (!Error) {
+    waitpid(Pid, NULL, 0);
+  }
+}
+
+/**
+ * @brief Run the target through the fork server of S on the input file of
+ * S.
+ *
+ * @return bool False if the run was cancelled before it started.
+ */
+bool Tester::runServer(Slot &S, size_t Index, Signature &Result) {
+  uint32_t Request = 0;
+  int32_t Pid;
+  {
+    std::lock_guard<std::mutex> Guard(S.Lock);
+    if (Index > Failing) {
+      return false;
+    }
+    if (write(S.ControlFd, &Request, sizeof(Request)) != sizeof(Request) ||
+        !readAll(S.StatusFd, &Pid, sizeof(Pid))) {
+      fprintf(stderr, "The fork server of %s exited\n", Target.c_str());
+      exit(1);
+    }
+    S.Pid = Pid;
+    S.Index = Index;
+  }
+  ++NumTests;
+
+  // The server keeps the child a zombie until the next request, so its pid
+  // is not reused while another worker may still cancel it.
+  if (!readAll(S.StatusFd, &Result, sizeof(Result))) {
+    fprintf(stderr, "The fork server of %s exited\n", Target.c_str());
+    exit(1);
+  }
+  {
+    std::lock_guard<std::mutex> Guard(S.Lock);
+    S.Pid = 0;
+  }
+  return true;
+}
+
+/**
+ * @brief Kill the targets running candidates after Index.
+ */
+void Tester::cancelAfter(size_t Index) {
+  for (auto &S : Slots) {
+    std::lock_guard<std::mutex> Guard(S.Lock);
+    if (S.Pid && S.Index > Index) {
+      kill(S.Pid, SIGKILL);
+    }
+  }
+}
+
+size_t
+Tester::firstFailing(size_t NumCandidates,
+                     const std::function<std::string(size_t)> &Candidate) {
+  Failing = NumCandidates;
+  std::atomic<size_t> Next{0};
+  std::vector<std::thread> Workers;
+  for (unsigned I = 0; I < std::min(Slots.size(), NumCandidates); ++I) {
+    Workers.emplace_back([&, I]() {
+      std::string InputPath = inputPath(I);
+      for (size_t C = Next++; C < Failing; C = Next++) {
+        Signature Result;
+        if (!run(Candidate(C), InputPath, Slots[I], C, Result) ||
+            !fails(Result)) {
+          continue;
+        }
+        size_t Current = Failing;
+        while (C < Current && !Failing.compare_exchange_weak(Current, C)) {
+        }
+        if (C < Current) {
+          cancelAfter(C);
+        }
+      }
+    });
+  }
+  for (auto &Worker : Workers) {
+    Worker.join();
+  }
+  return Failing;
+}
+
+/// The units of an input, which join back into the input.
+using Units = std::vector<std::string>;
+
+/**
+ * @brief Split Input into units that end after a byte of Boundaries, or
+ * into single bytes if there are no Boundaries.
+ */
+Units splitUnits(const std::string &Input, const std::string &Boundaries) {
+  Units Result;
+  size_t Start = 0;
+  for (size_t I = 0; I < Input.size(); ++I) {
+    if (Boundaries.empty() || Boundaries.find(Input[I]) != std::string::npos) {
+      Result.push_back(Input.substr(Start, I + 1 - Start));
+      Start = I + 1;
+    }
+  }
+  if (Start < Input.size()) {
+    Result.push_back(Input.substr(Start));
+  }
+  return Result;
+}
+
+/**
+ * The candidates of a ddmin round: U split into N chunks of nearly equal
+ * size, followed by their complements unless N is 2, where the complements
+ * are the chunks themselves. This is the order delta_debugger/reducer.py
+ * tests them in. Candidates are only built when they are tested.
+ */
+class Round {
+public:
+  Round(const Units &U, size_t N) : U(U), N(N) {
+    for (size_t I = 0; I <= N; ++I) {
+      Bounds.push_back(U.size() * I / N);
+    }
+  }
+
+  size_t size() const { return N == 2 ? N : 2 * N; }
+
+  /// The units of candidate Index.
+  Units units(size_t Index) const {
+    Units Result;
+    forEachUnit(Index, [&](const std::string &Unit) { Result.push_back(Unit); });
+    return Result;
+  }
+
+  /// The input of candidate Index.
+  std::string input(size_t Index) const {
+    std::string Result;
+    forEachUnit(Index, [&](const std::string &Unit) { Result += Unit; });
+    return Result;
+  }
+
+private:
+  template <typename Callback>
+  void forEachUnit(size_t Index, Callback Fn) const {
+    for (size_t I = 0; I < U.size(); ++I) {
+      bool InChunk = I >= Bounds[Index % N] && I < Bounds[Index % N + 1];
+      if (InChunk == (Index < N)) {
+        Fn(U[I]);
+      }
+    }
+  }
+
+  const Units &U;
+  size_t N;
+  std::vector<size_t> Bounds;
+};
+
+/**
+ * @brief Reduce the units of a crashing input to a 1-minimal set of units
+ * with ddmin.
+ */
+Units deltaDebug(Tester &T, Units U) {
+  size_t N = 2;
+  while (U.size() >= 2) {
+    Round R(U, N);
+    size_t Index =
+        T.firstFailing(R.size(), [&](size_t I) { return R.input(I); });
+    if (Index < N) {
+      U = R.units(Index);
+      N = 2;
+    } else if (Index < R.size()) {
+      U = R.units(Index);
+      N = std::max<size_t>(N - 1, 2);
+    } else if (N < U.size()) {
+      N = std::min(2 * N, U.size());
+    } else {
+      break;
+    }
+  }
+  return U;
+}
+
+int usage(const char *Program) {
+  fprintf(stderr,
+          "usage: %s (-j jobs) (-b boundaries)... (-a) [target] [crashing "
+          "input file] (output file)\n",
+          Program);
+  return 1;
+}
+
+/**
+ * Minimize a crashing input of a target with ddmin, testing the subsets
+ * and complements of each round in parallel. The result is the same as the
+ * one of the sequential delta debugger, and so is the outcome cache.
+ * Every -b gives the bytes that end a unit of one coarse level, from the
+ * coarsest to the finest. The input is reduced as units of each level in
+ * turn, and at last as single bytes. The reduced input keeps the crash
+ * signature of the input, unless -a lets it crash the target in any way.
+ *
+ * Usage:
+ * ./ddmin (-j jobs) (-b boundaries)... (-a) [target] [crashing input file]
+ *   (output file)
+ */
+int main(int argc, char **argv) {
+  unsigned Jobs = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> Levels;
+  bool AnyCrash = false;
+  for (int Opt; (Opt = getopt(argc, argv, "j:b:a")) != -1;) {
+    if (Opt == 'j') {
+      Jobs = std::max(1l, strtol(optarg, NULL, 10));
+    } else if (Opt == 'b') {
+      Levels.push_back(optarg);
+    } else if (Opt == 'a') {
+      AnyCrash = true;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  int First = optind;
+  if (argc - First < 2) {
+    return usage(argv[0]);
+  }
+  std::string Target(argv[First]);
+  std::string InputPath(argv[First + 1]);
+  std::string OutPath =
+      argc - First > 2 ? argv[First + 2] : InputPath + ".delta";
+  if (access(Target.c_str(), X_OK)) {
+    fprintf(stderr, "%s not found\n", Target.c_str());
+    return 1;
+  }
+
+  std::string Input, TargetData;
+  if (readFile(InputPath, Input) || readFile(Target, TargetData)) {
+    return 1;
+  }
+
+  OutcomeCache Cache;
+  // Inputs go through shared memory when there is some.
+  std::string TempDir = "/tmp/ddmin-XXXXXX";
+  struct stat Buffer;
+  if (stat("/dev/shm", &Buffer) == 0 && S_ISDIR(Buffer.st_mode)) {
+    TempDir = "/dev/shm/ddmin-XXXXXX";
+  }
+  if (mkdtemp(&TempDir[0]) == NULL) {
+    fprintf(stderr, "Cannot create a temporary directory\n");
+    return 1;
+  }
+  // A fork server for targets whose runtime has none is built next to
+  // ddmin.
+  std::string Preload;
+  char Exe[PATH_MAX];
+  ssize_t ExeSize = readlink("/proc/self/exe", Exe, sizeof(Exe) - 1);
+  if (ExeSize != -1) {
+    Preload = std::string(Exe, ExeSize);
+    Preload = Preload.substr(0, Preload.rfind('/') + 1) + "libforkserver.so";
+    if (access(Preload.c_str(), R_OK)) {
+      Preload.clear();
+    }
+  }
+  // A fork server that exits must not take ddmin down with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  Tester T(Target, TempDir, Jobs, Cache, Preload);
+  if (Cache.open(Target, TargetData, T.startServers())) {
+    return 1;
+  }
+  Signature Expected = T.signature(Input);
+  if (Expected.return_code == 0) {
+    fprintf(stderr,
+            "Sanity check failed: the program does not crash with the "
+            "initial input\n");
+    return 1;
+  }
+  fprintf(stderr,
+          "Crash signature: return code %d, line %d, col %d, site %08x\n",
+          Expected.return_code, Expected.line, Expected.col, Expected.site);
+  T.expect(Expected, AnyCrash);
+  std::string Result = Input;
+  Levels.push_back("");
+  for (size_t Level = 0; Level < Levels.size(); ++Level) {
+    Units U = splitUnits(Result, Levels[Level]);
+    Units Reduced = deltaDebug(T, U);
+    fprintf(stderr, "Reduced %zu to %zu units of level %zu\n", U.size(),
+            Reduced.size(), Level + 1);
+    Result.clear();
+    for (auto &Unit : Reduced) {
+      Result += Unit;
+    }
+  }
+
+  FILE *Out = fopen(OutPath.c_str(), "wb");
+  if (Out == NULL ||
+      fwrite(Result.data(), 1, Result.size(), Out) != Result.size() ||
+      fclose(Out)) {
+    fprintf(stderr, "Cannot write %s\n", OutPath.c_str());
+    return 1;
+  }
+  fprintf(stderr, "Minimized %zu bytes to %zu bytes in %zu tests\n",
+          Input.size(), Result.size(), T.NumTests.load());
+  Cache.report(T.NumTests);
+  return 0;
+}
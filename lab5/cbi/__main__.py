@@ -5,22 +5,32 @@ import sys
 
 from dataclasses import asdict
 from pathlib import Path
+from subprocess import run
 
-from cbi.cbi import cbi
-from cbi.utils import get_logs
+from cbi.cbi import cbi, eliminate
+from cbi.store import CBIStore
+from cbi.utils import CBI_COLLECT, CBI_SCORE, collect_matrix, get_logs
 
 
 def main() -> int:
     """
-    Usage: cbi [target] [fuzzer-output-dir]
+    Usage: cbi [target] [fuzzer-output-dir] (--eliminate) (--store)
+
+    With --eliminate, predicates are also ranked by iterative elimination.
+    With --store, only inputs that are not in the CBI store of the target
+    yet are run, and the report is computed from the counters of the store.
     """
-    if len(sys.argv) < 3:
+    flags = {"--eliminate", "--store"}
+    args = [arg for arg in sys.argv[1:] if arg not in flags]
+    eliminate_predicates = "--eliminate" in sys.argv[1:]
+    use_store = "--store" in sys.argv[1:]
+    if len(args) != 2:
         print(
-            f"Usage: cbi [target] [fuzzer-output-dir]",
+            f"Usage: cbi [target] [fuzzer-output-dir] (--eliminate) (--store)",
             file=sys.stderr,
         )
         return 1
-    target, fuzz_output_dir = sys.argv[1:]
+    target, fuzz_output_dir = args
 
     if not Path(target).exists():
         print(f"{target} not found", file=sys.stderr)
@@ -29,20 +39,44 @@ def main() -> int:
         print(f"{fuzz_output_dir} not found", file=sys.stderr)
         return 1
 
-    # Generate the cbi logs
-    success_logs, failure_logs = get_logs(target=target, fuzz_dir=Path(fuzz_output_dir))
-    # Analyze the cbi logs and generate the report
-    report = cbi(success_logs=success_logs, failure_logs=failure_logs)
+    if use_store:
+        # Only run the new inputs, and score the counters of the store.
+        store = CBIStore(target)
+        store.ingest(Path(fuzz_output_dir))
+        report = store.report()
+        if eliminate_predicates:
+            success_logs, failure_logs = store.logs()
+    elif not eliminate_predicates and CBI_COLLECT.exists() and CBI_SCORE.exists():
+        # With the native tools, collect a predicate matrix and score it
+        # without decoding the runs in Python.
+        matrix = collect_matrix(target=target, fuzz_dir=Path(fuzz_output_dir))
+        process = run([str(CBI_SCORE), str(matrix), f"{target}.report.json"])
+        return process.returncode
+    else:
+        # Generate the cbi logs
+        success_logs, failure_logs = get_logs(
+            target=target, fuzz_dir=Path(fuzz_output_dir)
+        )
+        # Analyze the cbi logs and generate the report
+        report = cbi(success_logs=success_logs, failure_logs=failure_logs)
     # Visualize the report
     print(report)
     # Save the report to a file
     with open(f"{target}.report.json", "w") as fp:
         json.dump(asdict(report), fp, indent=4)
+
+    if eliminate_predicates:
+        steps = eliminate(success_logs=success_logs, failure_logs=failure_logs)
+        print("== Elimination ==")
+        for number, step in enumerate(steps, start=1):
+            print(f"{number}. {step}")
+        with open(f"{target}.eliminate.json", "w") as fp:
+            json.dump([asdict(step) for step in steps], fp, indent=4)
     return 0
 
 
 if __name__ == "__main__":
     """
-    Usage: cbi [target] [fuzzer-output-dir]
+    Usage: cbi [target] [fuzzer-output-dir] (--eliminate) (--store)
     """
     sys.exit(main())
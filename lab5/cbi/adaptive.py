@@ -0,0 +1,160 @@
+#! /usr/bin/env python3
+"""
+Adaptive bug isolation in the style of Arumuga Nainar and Liblit.
+
+Instead of instrumenting every branch of the target, start with the return
+value sites only and, each round, re-instrument the functions that held the
+most important predicates, along with their callers and callees.
+Rounds continue until the set of instrumented functions, and with it the
+ranking, stops changing, so the overhead follows the suspicious region
+rather than the size of the program.
+
+Usage: python3 -m cbi.adaptive [target] [fuzzer-output-dir] (max rounds)
+
+The target must have been built by test/Makefile, which leaves the
+coverage-instrumented IR of the target in [target].instrumented.ll.
+"""
+
+import json
+import sys
+
+from dataclasses import asdict
+from pathlib import Path
+from subprocess import run
+from typing import Dict, List, Optional, Set, Tuple
+
+from cbi.cbi import cbi
+from cbi.data_format import Report
+from cbi.utils import CBI_BUILD_DIR, get_logs
+
+CBI_PASS = CBI_BUILD_DIR / "CBIInstrumentPass.so"
+DEFAULT_MAX_ROUNDS = 5
+
+# Predicates at least this fraction as important as the top one are
+# suspicious.
+IMPORTANCE_RATIO = 0.5
+
+
+def build_round(
+    target: str, functions: Optional[Set[str]]
+) -> Dict[Tuple[int, int], str]:
+    """
+    Build the target of one round as [target]-adaptive.
+
+    :param target: The target program.
+    :param functions: The functions to instrument, with their neighbors in
+        the call graph, or None to instrument return values only.
+    :return: The function of every site, by line and column.
+    """
+    site_map = Path(f"{target}.cbi.sites")
+    flags = [f"-cbi-site-map={site_map}"]
+    if functions is None:
+        flags.append("-cbi-coarse")
+    else:
+        function_list = Path(f"{target}.cbi.functions")
+        function_list.write_text("".join(f"{name}\n" for name in sorted(functions)))
+        flags.append(f"-cbi-functions={function_list}")
+
+    instrumented = f"{target}.adaptive.ll"
+    process = run(
+        ["opt", "-load", str(CBI_PASS), "-CBIInstrument", *flags, "-S"]
+        + [f"{target}.instrumented.ll", "-o", instrumented]
+    )
+    assert process.returncode == 0, "opt failed"
+    process = run(
+        ["clang", "-o", f"{target}-adaptive", f"-L{CBI_BUILD_DIR}", "-lruntime"]
+        + ["-lm", instrumented]
+    )
+    assert process.returncode == 0, "clang failed"
+
+    sites: Dict[Tuple[int, int], str] = dict()
+    for line in site_map.read_text().splitlines():
+        site_line, site_column, function = line.split()
+        sites[int(site_line), int(site_column)] = function
+    return sites
+
+
+def suspicious_functions(
+    report: Report, sites: Dict[Tuple[int, int], str], num_failures: int
+) -> Set[str]:
+    """
+    :param report: The report of a round.
+    :param sites: The function of every site of the round.
+    :param num_failures: The number of failing runs.
+    :return: The functions that hold a predicate at least IMPORTANCE_RATIO
+        as important as the most important one.
+    """
+    importance = {
+        info.predicate: info.importance(num_failures)
+        for info in report.predicate_info_list
+    }
+    threshold = IMPORTANCE_RATIO * max(importance.values(), default=0)
+    return {
+        sites[predicate.line, predicate.column]
+        for predicate, value in importance.items()
+        if value > 0 and value >= threshold
+    }
+
+
+def main() -> int:
+    """
+    Usage: python3 -m cbi.adaptive [target] [fuzzer-output-dir] (max rounds)
+    """
+    if len(sys.argv) < 3:
+        print(
+            f"Usage: python3 -m cbi.adaptive [target] [fuzzer-output-dir] "
+            f"(max rounds)",
+            file=sys.stderr,
+        )
+        return 1
+    target, fuzz_output_dir = sys.argv[1:3]
+    max_rounds = int(sys.argv[3]) if len(sys.argv) > 3 else DEFAULT_MAX_ROUNDS
+
+    if not Path(f"{target}.instrumented.ll").exists():
+        print(f"{target}.instrumented.ll not found", file=sys.stderr)
+        return 1
+    if not Path(fuzz_output_dir).exists():
+        print(f"{fuzz_output_dir} not found", file=sys.stderr)
+        return 1
+
+    functions: Optional[Set[str]] = None
+    rounds: List[Dict] = list()
+    for number in range(1, max_rounds + 1):
+        sites = build_round(target, functions)
+        success_logs, failure_logs = get_logs(
+            target=f"{target}-adaptive", fuzz_dir=Path(fuzz_output_dir)
+        )
+        report = cbi(success_logs=success_logs, failure_logs=failure_logs)
+        suspicious = suspicious_functions(report, sites, len(failure_logs))
+        print(
+            f"Round {number}: {len(sites)} sites in "
+            f"{len(set(sites.values()))} functions, suspicious: "
+            f"{', '.join(sorted(suspicious)) or 'none'}",
+            file=sys.stderr,
+        )
+        rounds.append(
+            {
+                "instrumented": sorted(set(sites.values())),
+                "num_sites": len(sites),
+                "suspicious": sorted(suspicious),
+            }
+        )
+        if suspicious == functions or not suspicious:
+            break
+        functions = suspicious
+
+    # Visualize the report of the last round
+    print(report)
+    # Save the report to a file
+    with open(f"{target}.report.json", "w") as fp:
+        json.dump(asdict(report), fp, indent=4)
+    with open(f"{target}.adaptive.json", "w") as fp:
+        json.dump(rounds, fp, indent=4)
+    return 0
+
+
+if __name__ == "__main__":
+    """
+    Usage: python3 -m cbi.adaptive [target] [fuzzer-output-dir] (max rounds)
+    """
+    sys.exit(main())
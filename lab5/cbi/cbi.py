@@ -1,11 +1,15 @@
 #! /usr/bin/env python3
 
 from collections import defaultdict
+import copy
+import heapq
 import itertools
+import math
 from pathlib import Path
-from typing import Dict, Iterable, List, Set
+from typing import Dict, Iterable, List, Set, Tuple
 from cbi.data_format import (
     CBILog,
+    EliminationStep,
     ObservationStatus,
     Predicate,
     PredicateInfo,
@@ -24,6 +28,9 @@ def collect_observations(log: CBILog) -> Dict[Predicate, ObservationStatus]:
     further it also means you've observed is complement:
     `Predicate(line=3, column=5, pred_type="BranchFalse")` as False.
 
+    The entry of a scalar pair also names its variables, so pass
+    `entry.pair` along with `entry.value` to PredicateType.alternatives.
+
     :param log: the log
     :return: a dictionary of predicates and their observation status.
     """
@@ -75,5 +82,115 @@ def cbi(success_logs: List[CBILog], failure_logs: List[CBILog]) -> Report:
 
 
     # Finally, create a report and return it.
-    report = Report(predicate_info_list=list(predicate_infos.values()))
+    # Sorted, so that reports of the same runs are identical.
+    report = Report(
+        predicate_info_list=sorted(
+            predicate_infos.values(), key=lambda info: info.predicate
+        )
+    )
     return report
+
+
+def eliminate(
+    success_logs: List[CBILog], failure_logs: List[CBILog]
+) -> List[EliminationStep]:
+    """
+    Rank predicates by iterative elimination.
+
+    Each round selects the predicate with the highest importance, then
+    discards every run in which it was observed true, so that the next
+    round ranks what is left to explain. The counts are not recomputed:
+    discarding a run only updates the predicates the run observed, which
+    the per-run observations index, and the runs where a predicate is true
+    are indexed as well. All rounds together therefore touch every
+    observation at most twice.
+
+    Predicates wait in a heap, keyed by their importance times
+    log(NumF) at the time the key was computed. The importance of a
+    predicate whose counts do not change grows at most as fast as
+    1 / log(NumF) when failing runs are discarded, so the keys order upper
+    bounds of the current importances. Only the predicates of the discarded
+    runs get new keys; the others are re-ranked when they reach the top.
+
+    :param success_logs: logs of successful runs
+    :param failure_logs: logs of failing runs
+    :return: the selected predicates, in the order of the rounds
+    """
+    runs = [(collect_observations(log), False) for log in success_logs] + [
+        (collect_observations(log), True) for log in failure_logs
+    ]
+    observed_true = (ObservationStatus.ONLY_TRUE, ObservationStatus.BOTH)
+
+    def update(info: PredicateInfo, failed: bool, true: bool, delta: int):
+        if failed:
+            info.f_obs += delta
+            info.f += delta * true
+        else:
+            info.s_obs += delta
+            info.s += delta * true
+
+    predicate_infos: Dict[Predicate, PredicateInfo] = dict()
+    true_in_runs: Dict[Predicate, List[int]] = defaultdict(list)
+    for index, (observations, failed) in enumerate(runs):
+        for predicate, status in observations.items():
+            if predicate not in predicate_infos:
+                predicate_infos[predicate] = PredicateInfo(predicate)
+            true = status in observed_true
+            update(predicate_infos[predicate], failed, true, 1)
+            if true:
+                true_in_runs[predicate].append(index)
+
+    # The sensitivity is log(F(P)) / log(NumF), except that it is 1 when
+    # NumF is 1, where the keys are computed afresh.
+    def scale(num_failures: int) -> float:
+        return math.log(num_failures) if num_failures > 1 else 1.0
+
+    # Entries are (-key, predicate, version, NumF when the key was computed).
+    # Ties go to the first predicate in the program.
+    versions: Dict[Predicate, int] = defaultdict(int)
+    heap: List[Tuple[float, Predicate, int, int]] = list()
+
+    def push(predicate: Predicate, num_failures: int):
+        importance = predicate_infos[predicate].importance(num_failures)
+        key = importance * scale(num_failures)
+        heapq.heappush(heap, (-key, predicate, versions[predicate], num_failures))
+
+    def rebuild(num_failures: int):
+        heap.clear()
+        for predicate in predicate_infos:
+            push(predicate, num_failures)
+
+    discarded = [False] * len(runs)
+    num_failures = len(failure_logs)
+    rebuild(num_failures)
+    steps: List[EliminationStep] = list()
+    while num_failures > 0 and heap:
+        _, predicate, version, keyed_failures = heapq.heappop(heap)
+        if version != versions[predicate]:
+            continue
+        if keyed_failures != num_failures:
+            push(predicate, num_failures)
+            continue
+        best = predicate_infos[predicate]
+        importance = best.importance(num_failures)
+        if importance <= 0:
+            break
+        steps.append(EliminationStep(copy.copy(best), importance, num_failures))
+
+        changed: Set[Predicate] = set()
+        for index in true_in_runs[predicate]:
+            if discarded[index]:
+                continue
+            discarded[index] = True
+            observations, failed = runs[index]
+            num_failures -= failed
+            for observed, status in observations.items():
+                update(predicate_infos[observed], failed, status in observed_true, -1)
+                changed.add(observed)
+        if num_failures == 1 and keyed_failures > 1:
+            rebuild(num_failures)
+            continue
+        for observed in changed:
+            versions[observed] += 1
+            push(observed, num_failures)
+    return steps
@@ -1,5 +1,7 @@
 #! /usr/bin/env python3
 
+import math
+
 from enum import Enum
 from dataclasses import dataclass, field
 from typing import List, Tuple, Type, Union
@@ -10,16 +12,20 @@ class CBILogEntry:
     """
     Data class for a single entry in a CBI log.
 
-    :param kind: The kind of entry [branch/return].
+    :param kind: The kind of entry [branch/return/pair].
     :param line: The line number specified in the log.
     :param column: The column number specified in the log.
-    :param value: The value specified in the log.
+    :param value: The value specified in the log. For a pair, the sign of
+        the assigned value minus the value it was compared with.
+    :param pair: For a pair, the assigned variable and the variable it was
+        compared with, separated by a space.
     """
 
     kind: str
     line: int
     column: int
     value: Union[bool, int]
+    pair: str = ""
 
     @property
     def is_return(self) -> bool:
@@ -35,6 +41,13 @@ class CBILogEntry:
         """
         return self.kind == "branch"
 
+    @property
+    def is_pair(self) -> bool:
+        """
+        :return: True if the entry is a scalar pair.
+        """
+        return self.kind == "pair"
+
 
 """Type Alias for a list of CBILogEntry"""
 CBILog: Type[List[CBILogEntry]] = List[CBILogEntry]
@@ -105,8 +118,12 @@ class PredicateType:
     RETURN_TYPES = [RETURN_POSITIVE, RETURN_ZERO, RETURN_NEGATIVE]
     ALL_TYPES = BRANCH_TYPES + RETURN_TYPES
 
+    PAIR_OPERATORS = ["<", "==", ">"]
+
     @classmethod
-    def alternatives(cls, value: Union[bool, int]) -> List[Tuple[str, bool]]:
+    def alternatives(
+        cls, value: Union[bool, int], pair: str = ""
+    ) -> List[Tuple[str, bool]]:
         """
         Gel all possible Branch/Return types for a given value
         and whether value indicates a true or false observation for that type.
@@ -118,9 +135,22 @@ class PredicateType:
         condition that was evaluated as False, then the alternatives are:
             (BranchTrue, False), and (BranchFalse, True)
 
+        A scalar pair "x y" has the types "x < y", "x == y" and "x > y",
+        and value is the sign of x - y.
+
         :param value: The value corresponding to the predicate.
+        :param pair: The variables of a scalar pair, empty for other entries.
         :return: A list of tuples of (predicate_type, observation status).
         """
+        if pair:
+            assigned, other = pair.split(" ", 1)
+            return [
+                (
+                    f"{assigned} {operator} {other}",
+                    ObservationStatus.from_bool(sign == value),
+                )
+                for operator, sign in zip(cls.PAIR_OPERATORS, (-1, 0, 1))
+            ]
         pred_type = cls.from_value(value=value)
         if pred_type in cls.BRANCH_TYPES:
             return [
@@ -134,6 +164,16 @@ class PredicateType:
                 (cls.RETURN_NEGATIVE, ObservationStatus.from_bool(value < 0)),
             ]
 
+    @classmethod
+    def is_pair(cls, pred_type: Union[bool, int, str]) -> bool:
+        """
+        Check whether pred_type is the type of a scalar pair predicate.
+        """
+        if not isinstance(pred_type, str):
+            return False
+        parts = pred_type.split(" ")
+        return len(parts) == 3 and parts[1] in cls.PAIR_OPERATORS
+
     @staticmethod
     def from_value(value: Union[bool, int]) -> str:
         """
@@ -181,7 +221,7 @@ class Predicate:
         """
         self.line = line
         self.column = column
-        if value in PredicateType.ALL_TYPES:
+        if value in PredicateType.ALL_TYPES or PredicateType.is_pair(value):
             self.pred_type = value
         else:
             self.pred_type = PredicateType.from_value(value)
@@ -242,6 +282,25 @@ class PredicateInfo:
 
         return 0
 
+    def importance(self, num_failures: int) -> float:
+        """
+        The Importance of the predicate: the harmonic mean of its Increase
+        and of its sensitivity log(F(P)) / log(NumF), where NumF is the
+        number of failing runs.
+
+        :param num_failures: The number of failing runs.
+        :return: The importance value, 0 if Increase or F(P) is not positive.
+        """
+        if self.increase <= 0 or self.f == 0:
+            return 0.0
+        if num_failures == 1:
+            sensitivity = 1.0
+        else:
+            sensitivity = math.log(self.f) / math.log(num_failures)
+        if sensitivity <= 0:
+            return 0.0
+        return 2 / (1 / self.increase + 1 / sensitivity)
+
     """
     Helper methods that map variable names to names in lecture slides.
 
@@ -318,6 +377,30 @@ class PredicateInfo:
         )
 
 
+@dataclass
+class EliminationStep:
+    """
+    Data class for one round of iterative predicate elimination.
+
+    :param predicate_info: The selected predicate, with its counts over the
+        runs that were left in the round.
+    :param importance: The importance of the predicate in the round.
+    :param remaining_failures: The number of failing runs left in the round.
+    """
+
+    predicate_info: PredicateInfo
+    importance: float
+    remaining_failures: int
+
+    def __str__(self) -> str:
+        info = self.predicate_info
+        return (
+            f"{info.predicate}: importance {self.importance}, "
+            f"increase {info.increase}, "
+            f"true in {info.f} of {self.remaining_failures} failing runs"
+        )
+
+
 @dataclass
 class Report:
     """
@@ -0,0 +1,107 @@
+#! /usr/bin/env python3
+
+import os
+import struct
+import tempfile
+
+from pathlib import Path
+from subprocess import DEVNULL, Popen
+from typing import Dict, Optional, Tuple
+
+# Protocol of the fork server of the runtime, see include/ForkServer.h.
+FORK_SERVER_ENV = "FORK_SERVER"
+FORK_SERVER_HELLO = struct.Struct("=I").pack(0x31535246)
+FORK_SERVER_REQUEST = struct.Struct("=I").pack(0)
+FORK_SERVER_PID = struct.Struct("=i")
+FORK_SERVER_STATUS = struct.Struct("=iii")
+
+# Inputs are passed through a file in shared memory when there is one.
+SHM_DIR = Path("/dev/shm")
+
+
+def read_exactly(fd: int, size: int) -> bytes:
+    """
+    :return: size bytes read from fd, or fewer if fd was closed first.
+    """
+    data = b""
+    while len(data) < size:
+        chunk = os.read(fd, size - len(data))
+        if not chunk:
+            break
+        data += chunk
+    return data
+
+
+class ForkServer:
+    """
+    Runs the target through the fork server of its runtime: the target is
+    started once and forks a fresh copy of itself for every input, which
+    saves starting a process for every run. Use it as a context manager.
+    """
+
+    def __init__(self, target: str, env: Optional[Dict[str, str]] = None):
+        """
+        Start the fork server of target.
+
+        :param target: The target program to run.
+        :param env: Extra environment variables of the target.
+        """
+        self.target = target
+        self.env = env or dict()
+        self.alive = False
+
+    def __enter__(self) -> "ForkServer":
+        shm_dir = SHM_DIR if SHM_DIR.is_dir() else None
+        self.input_fd, self.input_path = tempfile.mkstemp(dir=shm_dir)
+        control_read, self.control_fd = os.pipe()
+        self.status_fd, status_write = os.pipe()
+        env = dict(os.environ, **self.env)
+        env[FORK_SERVER_ENV] = f"{control_read} {status_write} {self.input_path}"
+        self.process = Popen(
+            [self.target],
+            stdin=DEVNULL,
+            stdout=DEVNULL,
+            stderr=DEVNULL,
+            pass_fds=(control_read, status_write),
+            env=env,
+        )
+        os.close(control_read)
+        os.close(status_write)
+        # A runtime without a fork server runs main instead of saying hello.
+        self.alive = read_exactly(self.status_fd, 4) == FORK_SERVER_HELLO
+        return self
+
+    def __exit__(self, *exc) -> None:
+        os.close(self.control_fd)
+        os.close(self.status_fd)
+        self.process.wait()
+        os.close(self.input_fd)
+        os.unlink(self.input_path)
+        self.alive = False
+
+    def run(self, input: bytes) -> Tuple[int, Optional[Tuple[int, int]]]:
+        """
+        Run the target with input on its stdin.
+
+        :param input: The input to pass to the target program.
+        :return: The return code of the target program, and the line and
+            column where the sanitizer stopped it, if it did.
+        """
+        os.ftruncate(self.input_fd, 0)
+        os.pwrite(self.input_fd, input, 0)
+        os.write(self.control_fd, FORK_SERVER_REQUEST)
+        reply = read_exactly(
+            self.status_fd, FORK_SERVER_PID.size + FORK_SERVER_STATUS.size
+        )
+        if len(reply) != FORK_SERVER_PID.size + FORK_SERVER_STATUS.size:
+            raise RuntimeError(f"The fork server of {self.target} exited")
+        return_code, line, col = FORK_SERVER_STATUS.unpack_from(
+            reply, FORK_SERVER_PID.size
+        )
+        return return_code, (line, col) if line else None
+
+    def run_target(self, input: bytes) -> int:
+        """
+        Like utils.run_target, through the fork server.
+        """
+        return self.run(input)[0]
@@ -0,0 +1,332 @@
+#! /usr/bin/env python3
+
+import hashlib
+import json
+import os
+import shutil
+import struct
+import tempfile
+
+from pathlib import Path
+from sys import stderr
+from typing import BinaryIO, Dict, List, Set, Tuple
+
+from cbi.cbi import collect_observations
+from cbi.data_format import (
+    CBILog,
+    CBILogEntry,
+    ObservationStatus,
+    Predicate,
+    PredicateInfo,
+    Report,
+)
+from cbi.utils import (
+    CBI_COLLECT,
+    collect_matrix,
+    get_log_data_for_files,
+    list_inputs,
+    read_cbi_matrix,
+)
+
+CBI_STORE_EXTENSION = ".cbi.store"
+
+# Layout of the run log, in host byte order. Every run is one
+# CBI_STORE_RUN (input hash, failed, size of the entries in bytes)
+# followed by its entries, one CBI_STORE_ENTRY (kind, line, column, value,
+# size of the pair) for every value a site was observed with. The entry of
+# a scalar pair is followed by the variables of the pair.
+CBI_STORE_VERSION = 2
+CBI_STORE_RUN = struct.Struct("=32sBI")
+CBI_STORE_ENTRY = struct.Struct("=BiibH")
+CBI_STORE_KINDS = ["branch", "return", "pair"]
+
+
+def hash_file(path: Path, name: str = "") -> bytes:
+    """
+    :param path: The file to hash.
+    :param name: The name to hash the contents of path under.
+    :return: The SHA-256 digest of name and of the contents of path.
+    """
+    with open(path, "rb") as fp:
+        return hashlib.sha256(name.encode() + b"\0" + fp.read()).digest()
+
+
+def pack_entry(entry: CBILogEntry) -> bytes:
+    """
+    :return: The entry as it is kept in the run log.
+    """
+    pair = entry.pair.encode()
+    kind = CBI_STORE_KINDS.index(entry.kind)
+    value = int(entry.value)
+    return CBI_STORE_ENTRY.pack(kind, entry.line, entry.column, value, len(pair)) + pair
+
+
+def parse_runs(data: bytes) -> Tuple[List[Tuple[bytes, bool, CBILog]], int]:
+    """
+    Parse the runs in a part of the run log.
+
+    :param data: The part of the run log, starting at a run.
+    :return: The input hash, whether the run failed and the log of every
+        complete run, and the number of bytes they take.
+    """
+    runs = list()
+    offset = 0
+    while offset + CBI_STORE_RUN.size <= len(data):
+        digest, failed, size = CBI_STORE_RUN.unpack_from(data, offset)
+        end = offset + CBI_STORE_RUN.size + size
+        if end > len(data):
+            break
+        log: CBILog = list()
+        entry_offset = offset + CBI_STORE_RUN.size
+        while entry_offset < end:
+            kind, line, column, value, pair_size = CBI_STORE_ENTRY.unpack_from(
+                data, entry_offset
+            )
+            entry_offset += CBI_STORE_ENTRY.size
+            pair = data[entry_offset : entry_offset + pair_size].decode()
+            entry_offset += pair_size
+            kind = CBI_STORE_KINDS[kind]
+            if kind == "branch":
+                value = bool(value)
+            log.append(CBILogEntry(kind, line, column, value, pair))
+        runs.append((digest, bool(failed), log))
+        offset = end
+    return runs, offset
+
+
+class CBIStore:
+    """
+    Append-only database of CBI runs of one target, keyed by input hash.
+    The hash covers the name of the input in the fuzzer output as well as
+    its contents.
+
+    The store is a directory with two files:
+
+    runs
+        The observations of every run ingested so far. Runs are only ever
+        appended, so the log is never rewritten.
+    counters.json
+        The aggregate counters of every predicate over the runs in the
+        first `runs_size` bytes of the log, and the hash of the target they
+        were collected from.
+
+    Ingesting new runs appends them to the log and adds their observations
+    to the counters, so it costs O(new runs) no matter how many runs the
+    store already holds, and the report is computed from the counters
+    alone. If the target changes, its old observations no longer apply and
+    the store starts over.
+    """
+
+    def __init__(self, target: str):
+        """
+        Open the store of target, creating it if necessary.
+
+        :param target: The CBI-instrumented target program.
+        """
+        self.target = target
+        self.path = Path(target).with_suffix(CBI_STORE_EXTENSION)
+        self.runs_path = self.path / "runs"
+        self.counters_path = self.path / "counters.json"
+        self.target_hash = hash_file(Path(target)).hex()
+
+        self.predicate_infos: Dict[Predicate, PredicateInfo] = dict()
+        self.inputs: Set[bytes] = set()
+        self.runs_size = 0
+        self._load()
+
+    def _load(self) -> None:
+        counters = None
+        if self.counters_path.exists():
+            with open(self.counters_path) as fp:
+                counters = json.load(fp)
+        if (
+            counters is None
+            or counters.get("version") != CBI_STORE_VERSION
+            or counters["target"] != self.target_hash
+        ):
+            # The target was rebuilt, or the store is new or out of date.
+            shutil.rmtree(self.path, ignore_errors=True)
+            self.path.mkdir(parents=True)
+            self.runs_path.touch()
+            self._save()
+            return
+
+        self.runs_size = counters["runs_size"]
+        for line, column, pred_type, s, f, s_obs, f_obs in counters["predicates"]:
+            predicate = Predicate(line, column, pred_type)
+            info = PredicateInfo(predicate)
+            info.s, info.f, info.s_obs, info.f_obs = s, f, s_obs, f_obs
+            self.predicate_infos[predicate] = info
+
+        with open(self.runs_path, "r+b") as fp:
+            # Only the input hashes of the counted runs are needed.
+            offset = 0
+            while offset < self.runs_size:
+                fp.seek(offset)
+                digest, _, size = CBI_STORE_RUN.unpack(fp.read(CBI_STORE_RUN.size))
+                self.inputs.add(digest)
+                offset += CBI_STORE_RUN.size + size
+
+            # Count the runs appended by an ingest that was interrupted
+            # before it saved the counters.
+            pending = self._read_runs(fp)
+            for digest, failed, log in pending:
+                self._count(digest, failed, log)
+            if pending:
+                self._save()
+
+    def _read_runs(self, fp: BinaryIO) -> List[Tuple[bytes, bool, CBILog]]:
+        """
+        Read the runs after runs_size, dropping a partially written one.
+        """
+        fp.seek(self.runs_size)
+        runs, size = parse_runs(fp.read())
+        fp.truncate(self.runs_size + size)
+        self.runs_size += size
+        return runs
+
+    def _count(self, digest: bytes, failed: bool, log: CBILog) -> None:
+        """
+        Add the observations of one run to the counters.
+        """
+        self.inputs.add(digest)
+        for predicate, status in collect_observations(log).items():
+            if predicate not in self.predicate_infos:
+                self.predicate_infos[predicate] = PredicateInfo(predicate)
+            info = self.predicate_infos[predicate]
+            observed_true = status in (
+                ObservationStatus.ONLY_TRUE,
+                ObservationStatus.BOTH,
+            )
+            if failed:
+                info.f_obs += 1
+                info.f += observed_true
+            else:
+                info.s_obs += 1
+                info.s += observed_true
+
+    def _save(self) -> None:
+        """
+        Replace the counters, so that an interrupted save keeps the old ones.
+        """
+        counters = {
+            "version": CBI_STORE_VERSION,
+            "target": self.target_hash,
+            "runs_size": self.runs_size,
+            "predicates": [
+                [
+                    info.predicate.line,
+                    info.predicate.column,
+                    info.predicate.pred_type,
+                    info.s,
+                    info.f,
+                    info.s_obs,
+                    info.f_obs,
+                ]
+                for info in self.predicate_infos.values()
+            ],
+        }
+        fd, temp_path = tempfile.mkstemp(dir=self.path)
+        with os.fdopen(fd, "w") as fp:
+            json.dump(counters, fp)
+        os.replace(temp_path, self.counters_path)
+
+    def add_runs(self, runs: List[Tuple[bytes, bool, CBILog]]) -> None:
+        """
+        Append runs to the store and update the counters.
+
+        :param runs: The input hash, whether the run failed and the log of
+            every run.
+        """
+        with open(self.runs_path, "ab") as fp:
+            for digest, failed, log in runs:
+                entries = b"".join(pack_entry(entry) for entry in log)
+                fp.write(CBI_STORE_RUN.pack(digest, failed, len(entries)))
+                fp.write(entries)
+                self.runs_size += CBI_STORE_RUN.size + len(entries)
+                self._count(digest, failed, log)
+        self._save()
+
+    def ingest(self, fuzz_dir: Path) -> int:
+        """
+        Run the target on the inputs under fuzz_dir that are not in the
+        store yet, and add their runs. When cbi-collect has been built, the
+        new inputs run in parallel.
+
+        :param fuzz_dir: The directory containing the fuzzer output.
+        :return: The number of new runs.
+        """
+        new_inputs: Dict[bool, List[Path]] = {False: list(), True: list()}
+        digests: Dict[bool, List[bytes]] = {False: list(), True: list()}
+        seen = set(self.inputs)
+        for failed, input_dir in ((False, "success"), (True, "failure")):
+            for file in list_inputs(fuzz_dir / input_dir):
+                # Fuzzers write equal inputs to different files, and each
+                # of them is a run of its own.
+                digest = hash_file(file, f"{input_dir}/{file.name}")
+                if digest not in seen:
+                    seen.add(digest)
+                    new_inputs[failed].append(file)
+                    digests[failed].append(digest)
+
+        if not digests[False] and not digests[True]:
+            success_logs, failure_logs = list(), list()
+        elif CBI_COLLECT.exists():
+            # Point cbi-collect to the new inputs only. Numbered names keep
+            # the order of the inputs.
+            with tempfile.TemporaryDirectory() as temp_dir:
+                for failed, input_dir in ((False, "success"), (True, "failure")):
+                    (Path(temp_dir) / input_dir).mkdir()
+                    for index, file in enumerate(new_inputs[failed]):
+                        link = Path(temp_dir) / input_dir / f"input{index:09}"
+                        link.symlink_to(file.resolve())
+                success_logs, failure_logs = read_cbi_matrix(
+                    collect_matrix(self.target, Path(temp_dir))
+                )
+        else:
+            success_logs = get_log_data_for_files(
+                target=self.target,
+                files=new_inputs[False],
+                expected_return_code=0,
+                desc="Processing new successful inputs",
+            )
+            failure_logs = get_log_data_for_files(
+                target=self.target,
+                files=new_inputs[True],
+                expected_return_code=1,
+                desc="Processing new failing inputs",
+            )
+
+        runs = [
+            (digest, False, log) for digest, log in zip(digests[False], success_logs)
+        ] + [(digest, True, log) for digest, log in zip(digests[True], failure_logs)]
+        self.add_runs(runs)
+        print(
+            f"Added {len(runs)} new runs, {len(self.inputs)} runs in {self.path}",
+            file=stderr,
+        )
+        return len(runs)
+
+    def logs(self) -> Tuple[List[CBILog], List[CBILog]]:
+        """
+        Read back the logs of every run in the store.
+
+        :return: The CBILogs of the successful runs and of the failing runs.
+        """
+        with open(self.runs_path, "rb") as fp:
+            runs, _ = parse_runs(fp.read(self.runs_size))
+        success_logs = [log for _, failed, log in runs if not failed]
+        failure_logs = [log for _, failed, log in runs if failed]
+        return success_logs, failure_logs
+
+    def report(self) -> Report:
+        """
+        Compute the CBI report from the counters.
+
+        :return: the report
+        """
+        return Report(
+            predicate_info_list=sorted(
+                self.predicate_infos.values(), key=lambda info: info.predicate
+            )
+        )
@@ -1,6 +1,6 @@
 #! /usr/bin/env python3
 
-import json
+import struct
 
 from contextlib import suppress
 from typing import Dict, List, Tuple, Union
@@ -11,6 +11,7 @@ from sys import stderr
 from tqdm import tqdm
 
 from cbi.data_format import CBILog, CBILogEntry
+from cbi.forkserver import ForkServer
 
 
 def run_target(target: str, input: Union[str, bytes]) -> int:
@@ -38,7 +39,195 @@ def run_target(target: str, input: Union[str, bytes]) -> int:
     return process.returncode
 
 
-CBI_EXTENSION = ".cbi.jsonl"
+CBI_EXTENSION = ".cbi"
+CBI_MATRIX_EXTENSION = ".cbi.matrix"
+
+# Layout of the predicate record, see include/CBIRecord.h.
+CBI_RECORD_MAGIC = 0x32494243
+CBI_HEADER = struct.Struct("=III4x")
+CBI_SITE = struct.Struct("=iiiBB2xI")
+CBI_BRANCH_SITE = 0
+CBI_RETURN_SITE = 1
+CBI_PAIR_SITE = 2
+CBI_OBSERVED = 1 << 0
+
+# Values of a CBILogEntry that stand for each true bit of a site.
+CBI_BRANCH_VALUES = [(1 << 1, True), (1 << 2, False)]
+CBI_RETURN_VALUES = [(1 << 1, 1), (1 << 2, 0), (1 << 3, -1)]
+CBI_PAIR_VALUES = [(1 << 1, -1), (1 << 2, 0), (1 << 3, 1)]
+
+
+def read_name(names: bytes, offset: int) -> str:
+    """
+    The NUL-terminated site name at offset of the names of a record or
+    matrix.
+    """
+    return names[offset : names.index(b"\0", offset)].decode()
+
+
+def read_cbi_record(path: Path) -> CBILog:
+    """
+    Read the predicate record written by the runtime for one run.
+
+    Every value a site was observed with becomes one CBILogEntry, which is
+    all collect_observations needs to know about the run.
+
+    :param path: The record file.
+    :return: The CBILog of the run.
+    """
+    data = path.read_bytes()
+    magic, num_sites, names_size = CBI_HEADER.unpack_from(data)
+    if magic != CBI_RECORD_MAGIC:
+        raise ValueError(f"{path} is not a CBI record")
+    names = data[CBI_HEADER.size + num_sites * CBI_SITE.size :]
+
+    log: CBILog = list()
+    for site_index in range(num_sites):
+        offset = CBI_HEADER.size + site_index * CBI_SITE.size
+        _, line, column, kind, bits, name = CBI_SITE.unpack_from(data, offset)
+        pair = read_name(names, name) if kind == CBI_PAIR_SITE else ""
+        log.extend(site_entries(line, column, kind, bits, pair))
+    return log
+
+
+def site_entries(
+    line: int, column: int, kind: int, bits: int, pair: str = ""
+) -> CBILog:
+    """
+    Every value a site was observed with, as CBILogEntry objects.
+    """
+    if not bits & CBI_OBSERVED:
+        return []
+    if kind == CBI_BRANCH_SITE:
+        entry_kind, values = "branch", CBI_BRANCH_VALUES
+    elif kind == CBI_RETURN_SITE:
+        entry_kind, values = "return", CBI_RETURN_VALUES
+    else:
+        entry_kind, values = "pair", CBI_PAIR_VALUES
+    return [
+        CBILogEntry(
+            kind=entry_kind, line=line, column=column, value=value, pair=pair
+        )
+        for bit, value in values
+        if bits & bit
+    ]
+
+
+# Layout of the predicate matrix, see include/CBIMatrix.h.
+CBI_MATRIX_MAGIC = 0x324D4243
+CBI_MATRIX_HEADER = struct.Struct("=IIIIQ")
+CBI_MATRIX_SITE = struct.Struct("=iiB3xI")
+CBI_MATRIX_RUN = struct.Struct("=QIB3x")
+CBI_MATRIX_ENTRY = struct.Struct("=IB3x")
+
+# Native tools built next to the instrumentation passes.
+CBI_BUILD_DIR = Path(__file__).resolve().parent.parent / "build"
+CBI_COLLECT = CBI_BUILD_DIR / "cbi-collect"
+CBI_SCORE = CBI_BUILD_DIR / "cbi-score"
+
+
+def read_cbi_matrix(path: Path) -> Tuple[List[CBILog], List[CBILog]]:
+    """
+    Read the predicate matrix written by cbi-collect.
+
+    :param path: The matrix file.
+    :return: The CBILogs of the successful runs and of the failing runs.
+    """
+    data = path.read_bytes()
+    magic, num_sites, num_runs, _, num_entries = CBI_MATRIX_HEADER.unpack_from(data)
+    if magic != CBI_MATRIX_MAGIC:
+        raise ValueError(f"{path} is not a CBI matrix")
+
+    offset = CBI_MATRIX_HEADER.size
+    sites = [
+        CBI_MATRIX_SITE.unpack_from(data, offset + i * CBI_MATRIX_SITE.size)
+        for i in range(num_sites)
+    ]
+    offset += num_sites * CBI_MATRIX_SITE.size
+    runs = [
+        CBI_MATRIX_RUN.unpack_from(data, offset + i * CBI_MATRIX_RUN.size)
+        for i in range(num_runs)
+    ]
+    offset += num_runs * CBI_MATRIX_RUN.size
+    names = data[offset + num_entries * CBI_MATRIX_ENTRY.size :]
+    sites = [
+        (line, column, kind, read_name(names, name) if kind == CBI_PAIR_SITE else "")
+        for line, column, kind, name in sites
+    ]
+
+    success_logs: List[CBILog] = list()
+    failure_logs: List[CBILog] = list()
+    for first_entry, num_entries, failed in runs:
+        log: CBILog = list()
+        for i in range(first_entry, first_entry + num_entries):
+            site, bits = CBI_MATRIX_ENTRY.unpack_from(
+                data, offset + i * CBI_MATRIX_ENTRY.size
+            )
+            line, column, kind, pair = sites[site]
+            log.extend(site_entries(line, column, kind, bits, pair))
+        (failure_logs if failed else success_logs).append(log)
+    return success_logs, failure_logs
+
+
+def list_inputs(input_dir: Path) -> List[Path]:
+    """
+    The input files the fuzzer wrote to input_dir, sorted by name.
+    """
+    return sorted(
+        file
+        for file in input_dir.glob("input*")
+        if file.is_file() and len(file.suffixes) == 0
+    )
+
+
+def get_log_data_for_files(
+    target: str, files: List[Path], expected_return_code: int = 0, desc: str = ""
+) -> List[CBILog]:
+    """
+    Get the logs for the target program on the given input files.
+
+    :param target: The target program to run.
+    :param files: The input files.
+    :param expected_return_code: The expected return code of the target program.
+    :param desc: The description of the progress bar.
+    :return: A list of CBILogs, one for every file in files.
+    """
+    log_file = Path(target).with_suffix(CBI_EXTENSION)
+    if not files:
+        return list()
+
+    # Runs go through the fork server of the runtime, if it has one.
+    with ForkServer(target) as server:
+        # Clean up old file if necessary
+        with suppress(FileNotFoundError):
+            log_file.unlink()
+
+        progress_bar = tqdm(
+            files,
+            desc=desc,
+            dynamic_ncols=True,
+        )
+
+        log_data: List[CBILog] = list()
+        for file in progress_bar:
+            #  Run the target program with file
+            with open(file, "rb") as fp:
+                if server.alive:
+                    return_code = server.run_target(fp.read())
+                else:
+                    return_code = run_target(target=target, input=fp.read())
+                assert (
+                    return_code == expected_return_code
+                ), f"return_code didn't match expected value: {expected_return_code}"
+
+            if not log_file.exists():
+                log_data.append([])
+            else:
+                # Move the log file to appropriate location.
+                log_save_location = file.with_suffix(CBI_EXTENSION)
+                log_file.rename(log_save_location)
+                log_data.append(read_cbi_record(log_save_location))
+    return log_data
 
 
 def get_log_data_for_dir(
@@ -52,51 +241,36 @@ def get_log_data_for_dir(
     :param expected_return_code: The expected return code of the target program.
     :return: A list of CBILogs, one for every file in input_dir.
     """
-    log_file = Path(target).with_suffix(CBI_EXTENSION)
-
-    # Clean up old file if necessary
-    with suppress(FileNotFoundError):
-        log_file.unlink()
-
-    progress_bar = tqdm(
-        [
-            file
-            for file in input_dir.glob("input*")
-            if file.is_file() and len(file.suffixes) == 0
-        ],
+    return get_log_data_for_files(
+        target=target,
+        files=list_inputs(input_dir),
+        expected_return_code=expected_return_code,
         desc=f"Processing {input_dir}",
-        dynamic_ncols=True,
     )
 
-    log_data: List[CBILog] = list()
-    for file in progress_bar:
-        #  Run the target program with file
-        with open(file, "rb") as fp:
-            return_code = run_target(target=target, input=fp.read())
-            assert (
-                return_code == expected_return_code
-            ), f"return_code didn't match expected value: {expected_return_code}"
-
-        if not log_file.exists():
-            log_data.append([])
-        else:
-            # Move the log file to appropriate location.
-            log_save_location = file.with_suffix(CBI_EXTENSION)
-            log_file.rename(log_save_location)
-            with log_save_location.open("r") as fp:
-                # Parse all lines in the log file and add them to the log_data
-                log_data.append(
-                    [CBILogEntry(**json.loads(log_entry)) for log_entry in fp.readlines()]
-                )
-    return log_data
+
+def collect_matrix(target: str, fuzz_dir: Path) -> Path:
+    """
+    Run the target program on all inputs under fuzz_dir in parallel with
+    cbi-collect.
+
+    :param target: The target program to run.
+    :param fuzz_dir: The directory containing the fuzzer output.
+    :return: The predicate matrix written by cbi-collect.
+    """
+    matrix = Path(target).with_suffix(CBI_MATRIX_EXTENSION)
+    process = run([str(CBI_COLLECT), target, str(fuzz_dir), str(matrix)])
+    assert process.returncode == 0, "cbi-collect failed"
+    return matrix
 
 
 def get_logs(target: str, fuzz_dir: Path) -> Tuple[List[CBILog], List[CBILog]]:
     """
     Get all the logs for the target program.
 
-    Runs the target program with each input file under fuzz_dir to generate .cbi.jsonl files.
-    Parses the .cbi.jsonl files and returns two lists of CBILogs.
+    Runs the target program with each input file under fuzz_dir to generate .cbi files.
+    Reads the .cbi files and returns two lists of CBILogs.
+    When cbi-collect has been built, it runs the inputs in parallel instead.
 
     :param target: The target program to run.
     :param fuzz_dir: The directory containing the fuzzer output.
@@ -111,6 +285,9 @@ def get_logs(target: str, fuzz_dir: Path) -> Tuple[List[CBILog], List[CBILog]]:
     failure_dir.mkdir(parents=True, exist_ok=True)
 
     print("Collecting cbi logs...", file=stderr)
+    if CBI_COLLECT.exists():
+        return read_cbi_matrix(collect_matrix(target, fuzz_dir))
+
     success_logs = get_log_data_for_dir(
         target=target, input_dir=success_dir, expected_return_code=0
     )
@@ -0,0 +1,56 @@
+#ifndef CBI_MATRIX_H
+#define CBI_MATRIX_H
+
+#include <stdint.h>
+
+#include "CBIRecord.h"
+
+/**
+ * Predicate matrix written by cbi-collect to <target>.cbi.matrix.
+ *
+ * It combines the predicate records of every run into one file, in host
+ * byte order:
+ *
+ *   cbi_matrix_header
+ *   cbi_matrix_site   sites[num_sites]     sorted by line, column, kind, name
+ *   cbi_matrix_run    runs[num_runs]       successful runs first
+ *   cbi_matrix_entry  entries[num_entries] the sites observed by each run
+ *   char              names[names_size]    the names of the sites
+ *
+ * A run owns entries[first_entry, first_entry + num_entries), and its
+ * entries hold the cbi_site.bits the run recorded for a site. Site names
+ * are NUL-terminated and kept as in the record, see CBIRecord.h.
+ */
+#define CBI_MATRIX_MAGIC 0x324d4243 /* "CBM2" */
+#define CBI_MATRIX_EXTENSION ".cbi.matrix"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t num_sites;
+  uint32_t num_runs;
+  uint32_t names_size;
+  uint64_t num_entries;
+} cbi_matrix_header;
+
+typedef struct {
+  int32_t line;
+  int32_t col;
+  uint8_t kind;
+  uint8_t pad[3];
+  uint32_t name;
+} cbi_matrix_site;
+
+typedef struct {
+  uint64_t first_entry;
+  uint32_t num_entries;
+  uint8_t failed;
+  uint8_t pad[3];
+} cbi_matrix_run;
+
+typedef struct {
+  uint32_t site;
+  uint8_t bits;
+  uint8_t pad[3];
+} cbi_matrix_entry;
+
+#endif // CBI_MATRIX_H
@@ -0,0 +1,61 @@
+#ifndef CBI_RECORD_H
+#define CBI_RECORD_H
+
+#include <stdint.h>
+
+/**
+ * Predicate record written by the runtime to <executable>.cbi at exit.
+ *
+ * The file holds one cbi_header followed by one cbi_site for each site
+ * the run observed, in host byte order, and then names_size bytes of
+ * NUL-terminated site names. Each site keeps an observed bit and one true
+ * bit per predicate, so the size of the record depends on the number of
+ * sites and not on the number of executions.
+ * Only scalar-pair sites have a name: the assigned variable and the
+ * variable it is compared with, separated by a space. The name of a site
+ * is at offset name of the names, which start with an empty name.
+ * When CBI_RECORD is set in the environment, the record is written to
+ * that path instead, so that concurrent runs do not share a file.
+ * cbi/utils.py reads it back into a CBILog.
+ */
+#define CBI_RECORD_MAGIC 0x32494243 /* "CBI2" */
+#define CBI_RECORD_EXTENSION ".cbi"
+#define CBI_RECORD_ENV "CBI_RECORD"
+
+enum cbi_site_kind {
+  CBI_BRANCH_SITE = 0,
+  CBI_RETURN_SITE = 1,
+  CBI_PAIR_SITE = 2
+};
+
+/* Bits of cbi_site.bits. */
+enum {
+  CBI_OBSERVED = 1 << 0,
+  CBI_BRANCH_TRUE = 1 << 1,
+  CBI_BRANCH_FALSE = 1 << 2,
+  CBI_RETURN_POSITIVE = 1 << 1,
+  CBI_RETURN_ZERO = 1 << 2,
+  CBI_RETURN_NEGATIVE = 1 << 3,
+  CBI_PAIR_LESS = 1 << 1,
+  CBI_PAIR_EQUAL = 1 << 2,
+  CBI_PAIR_GREATER = 1 << 3,
+};
+
+typedef struct {
+  uint32_t magic;
+  uint32_t num_sites;
+  uint32_t names_size;
+  uint32_t pad;
+} cbi_header;
+
+typedef struct {
+  int32_t site;
+  int32_t line;
+  int32_t col;
+  uint8_t kind;
+  uint8_t bits;
+  uint8_t pad[2];
+  uint32_t name;
+} cbi_site;
+
+#endif // CBI_RECORD_H
@@ -1,8 +1,21 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "CBIRecord.h"
+#include "ForkServer.h"
+#include "LogBuffer.h"
+
 const int STR_MAX_SIZE = 1024;
 
 void get_logfile(char *buf, const int buf_size, const char *ext) {
@@ -23,39 +36,386 @@ void get_logfile(char *buf, const int buf_size, const char *ext) {
   strncat(buf, ext, strlen(ext));
 }
 
+/* Logs written through the shared per-thread buffers, see LogBuffer.h. */
+enum { COVERAGE_LOG };
+
+const char *const log_extensions[MAX_LOGS] = {".cov"};
+
+/*
+ * Predicate table.
+ *
+ * Sites are numbered by CBIInstrument. The state of a site lives in a page
+ * of CBI_PAGE_SIZE sites, allocated on first use, so the table needs no
+ * bound on the number of sites and is never moved. Hooks only set bits, so
+ * a site costs the same however often it runs, and the whole table is
+ * written as one record at exit or on a fatal signal.
+ */
+#define CBI_PAGE_BITS 12
+#define CBI_PAGE_SIZE (1 << CBI_PAGE_BITS)
+#define CBI_MAX_PAGES (1 << 12)
+
+typedef struct {
+  atomic_int line;
+  atomic_int col;
+  atomic_uchar kind;
+  atomic_uchar bits;
+  _Atomic(const char *) name;
+  unsigned char named; /* Whether the record being written has the name. */
+} site_state;
+
+static _Atomic(site_state *) site_pages[CBI_MAX_PAGES];
+static atomic_int predicates_used = 0;
+static pthread_once_t predicates_init_once = PTHREAD_ONCE_INIT;
+
+/* Write out the observed sites, if any site was reached. Only uses
+ * async-signal-safe calls. */
+static void write_predicates(void) {
+  if (atomic_load(&predicates_used) == 0) {
+    return;
+  }
+  char logfile[STR_MAX_SIZE];
+  const char *record = getenv(CBI_RECORD_ENV);
+  if (record != NULL) {
+    strncpy(logfile, record, sizeof(logfile) - 1);
+    logfile[sizeof(logfile) - 1] = 0;
+  } else {
+    get_logfile(logfile, sizeof(logfile), CBI_RECORD_EXTENSION);
+  }
+  int fd = open(logfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return;
+  }
+  /* The header is rewritten with the final counts once all sites are out,
+   * and the names follow the sites. */
+  cbi_header header = {CBI_RECORD_MAGIC, 0, 1, 0};
+  write(fd, &header, sizeof(header));
+
+  cbi_site records[64];
+  size_t count = 0;
+  for (int page = 0; page < CBI_MAX_PAGES; ++page) {
+    site_state *sites = atomic_load(&site_pages[page]);
+    for (int i = 0; sites != NULL && i < CBI_PAGE_SIZE; ++i) {
+      unsigned char bits = atomic_load(&sites[i].bits);
+      sites[i].named = 0;
+      if (bits == 0) {
+        continue;
+      }
+      cbi_site *record = &records[count++];
+      memset(record, 0, sizeof(*record));
+      record->site = (page << CBI_PAGE_BITS) | i;
+      record->line = atomic_load(&sites[i].line);
+      record->col = atomic_load(&sites[i].col);
+      record->kind = atomic_load(&sites[i].kind);
+      record->bits = bits;
+      const char *name = atomic_load(&sites[i].name);
+      if (name != NULL) {
+        record->name = header.names_size;
+        header.names_size += strlen(name) + 1;
+        sites[i].named = 1;
+      }
+      header.num_sites++;
+      if (count == sizeof(records) / sizeof(cbi_site)) {
+        write(fd, records, sizeof(records));
+        count = 0;
+      }
+    }
+  }
+  write(fd, records, count * sizeof(cbi_site));
+
+  /* Names in the same order as above, even if other threads are still
+   * reaching new sites. */
+  char names[4096];
+  size_t size = 1;
+  names[0] = 0;
+  for (int page = 0; page < CBI_MAX_PAGES; ++page) {
+    site_state *sites = atomic_load(&site_pages[page]);
+    for (int i = 0; sites != NULL && i < CBI_PAGE_SIZE; ++i) {
+      if (!sites[i].named) {
+        continue;
+      }
+      const char *name = atomic_load(&sites[i].name);
+      size_t length = strlen(name) + 1;
+      if (size + length > sizeof(names)) {
+        write(fd, names, size);
+        size = 0;
+      }
+      if (length > sizeof(names)) {
+        write(fd, name, length);
+      } else {
+        memcpy(names + size, name, length);
+        size += length;
+      }
+    }
+  }
+  write(fd, names, size);
+  pwrite(fd, &header, sizeof(header), 0);
+  close(fd);
+}
+
+static void init_predicates(void) {
+  atomic_store(&predicates_used, 1);
+  atexit(write_predicates);
+  log_on_fatal_signal(write_predicates);
+}
+
+static site_state *get_site(int site) {
+  site_state *sites = atomic_load_explicit(&site_pages[site >> CBI_PAGE_BITS],
+                                           memory_order_acquire);
+  if (sites != NULL) {
+    return &sites[site & (CBI_PAGE_SIZE - 1)];
+  }
+  if (site < 0 || site >= CBI_PAGE_SIZE * CBI_MAX_PAGES) {
+    fprintf(stderr, "Error: CBI site %d out of range\n", site);
+    exit(1);
+  }
+  pthread_once(&predicates_init_once, init_predicates);
+  site_state *page = calloc(CBI_PAGE_SIZE, sizeof(site_state));
+  if (page == NULL) {
+    fprintf(stderr, "Error: Cannot allocate CBI sites\n");
+    exit(1);
+  }
+  if (!atomic_compare_exchange_strong(&site_pages[site >> CBI_PAGE_BITS],
+                                      &sites, page)) {
+    free(page);
+    page = sites;
+  }
+  return &page[site & (CBI_PAGE_SIZE - 1)];
+}
+
+static void observe(int site, int line, int col, int kind, int bits,
+                    const char *name) {
+  site_state *state = get_site(site);
+  if (atomic_load_explicit(&state->bits, memory_order_relaxed) == 0) {
+    atomic_store_explicit(&state->line, line, memory_order_relaxed);
+    atomic_store_explicit(&state->col, col, memory_order_relaxed);
+    atomic_store_explicit(&state->kind, kind, memory_order_relaxed);
+    atomic_store_explicit(&state->name, name, memory_order_relaxed);
+  }
+  if ((atomic_load_explicit(&state->bits, memory_order_relaxed) & bits) !=
+      bits) {
+    atomic_fetch_or_explicit(&state->bits, CBI_OBSERVED | bits,
+                             memory_order_release);
+  }
+}
+
+/*
+ * Fork server, see ForkServer.h.
+ *
+ * The server runs as a constructor, so a child that returns from it goes
+ * on to main as if the target had just started. __sanitize__ leaves the
+ * location it stops a child at on a page the child shares with the server.
+ */
+static fork_server_status *sanitize_location = NULL;
+
+static int write_all(int fd, const void *data, size_t size) {
+  const char *bytes = data;
+  while (size > 0) {
+    ssize_t written = write(fd, bytes, size);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return -1;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return 0;
+}
+
+__attribute__((constructor)) static void fork_server(void) {
+  const char *config = getenv(FORK_SERVER_ENV);
+  int control_fd, status_fd, offset;
+  if (config == NULL ||
+      sscanf(config, "%d %d %n", &control_fd, &status_fd, &offset) != 2) {
+    return;
+  }
+  int input_fd = open(config + offset, O_RDONLY);
+  unsetenv(FORK_SERVER_ENV);
+  sanitize_location = mmap(NULL, sizeof(fork_server_status),
+                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                           -1, 0);
+  uint32_t hello = FORK_SERVER_HELLO;
+  if (input_fd == -1 || sanitize_location == MAP_FAILED ||
+      write_all(status_fd, &hello, sizeof(hello))) {
+    _exit(1);
+  }
+
+  uint32_t request;
+  pid_t child = 0;
+  while (read(control_fd, &request, sizeof(request)) == sizeof(request)) {
+    /* The last child stays a zombie until the next request, so that its
+     * pid is not reused while the reducer may still cancel it. */
+    if (child) {
+      waitpid(child, NULL, 0);
+    }
+    sanitize_location->line = sanitize_location->col = 0;
+    lseek(input_fd, 0, SEEK_SET);
+    child = fork();
+    if (child == -1) {
+      _exit(1);
+    }
+    if (child == 0) {
+      close(control_fd);
+      close(status_fd);
+      dup2(input_fd, 0);
+      close(input_fd);
+      return;
+    }
+
+    int32_t pid = child;
+    siginfo_t info;
+    if (write_all(status_fd, &pid, sizeof(pid))) {
+      _exit(1);
+    }
+    while (waitid(P_PID, child, &info, WEXITED | WNOWAIT) == -1 &&
+           errno == EINTR) {
+    }
+    fork_server_status status = {
+        info.si_code == CLD_EXITED ? info.si_status : -info.si_status,
+        sanitize_location->line, sanitize_location->col};
+    if (write_all(status_fd, &status, sizeof(status))) {
+      _exit(1);
+    }
+  }
+  if (child) {
+    waitpid(child, NULL, 0);
+  }
+  _exit(0);
+}
+
 void __sanitize__(int divisor, int line, int col) {
   if (divisor == 0) {
+    if (sanitize_location != NULL) {
+      sanitize_location->line = line;
+      sanitize_location->col = col;
+    }
     printf("Divide-by-zero detected at line %d and col %d\n", line, col);
     exit(1);
   }
 }
 
 void __coverage__(int line, int col) {
-  char logfile[STR_MAX_SIZE];
-  get_logfile(logfile, sizeof(logfile), ".cov");
-  FILE *f = fopen(logfile, "a");
-  fprintf(f, "%d,%d\n", line, col);
-  fclose(f);
+  char entry[32];
+  int size = snprintf(entry, sizeof(entry), "%d,%d\n", line, col);
+  log_append(COVERAGE_LOG, entry, size);
 }
 
-void __cbi_branch__(int line, int col, int cond) {
-  char logfile[STR_MAX_SIZE];
-  get_logfile(logfile, sizeof(logfile), ".cbi.jsonl");
-  FILE *f = fopen(logfile, "a");
-  fprintf(
-      f,
-      "{\"kind\": \"branch\", \"line\": %d, \"column\": %d, \"value\": %s}\n",
-      line, col, cond ? "true" : "false");
-  fclose(f);
+/*
+ * Site IDs are numbered from 0 in every module CBIInstrument runs on. The
+ * constructor of each instrumented module registers its number of sites
+ * here and adds the start of the range it gets to the IDs of its sites, so
+ * that sites of different modules never share a slot of the predicate
+ * table. Under the fork server, registration happens afresh in every child.
+ */
+int __cbi_register_sites__(int count) {
+  static atomic_int next_site = 0;
+  return atomic_fetch_add(&next_site, count);
 }
 
-void __cbi_return__(int line, int col, int rv) {
-  char logfile[STR_MAX_SIZE];
-  get_logfile(logfile, sizeof(logfile), ".cbi.jsonl");
-  FILE *f = fopen(logfile, "a");
-  fprintf(
-      f,
-      "{\"kind\": \"return\", \"line\": %d, \"column\": %d, \"value\": %d}\n",
-      line, col, rv);
-  fclose(f);
+void __cbi_branch__(int site, int line, int col, int cond) {
+  observe(site, line, col, CBI_BRANCH_SITE,
+          (cond & 1) ? CBI_BRANCH_TRUE : CBI_BRANCH_FALSE, NULL);
+}
+
+void __cbi_return__(int site, int line, int col, int rv) {
+  observe(site, line, col, CBI_RETURN_SITE,
+          rv > 0    ? CBI_RETURN_POSITIVE
+          : rv == 0 ? CBI_RETURN_ZERO
+                    : CBI_RETURN_NEGATIVE,
+          NULL);
+}
+
+/*
+ * A store compared with count variables. Comparison i is in bits 2i and
+ * 2i + 1 of packed: 0 for <, 1 for = and 2 for >, which maps to the
+ * CBI_PAIR_LESS, CBI_PAIR_EQUAL and CBI_PAIR_GREATER bits of site
+ * first_site + i.
+ */
+void __cbi_pairs__(int first_site, int line, int col, int count,
+                   unsigned packed, const char **names) {
+  for (int i = 0; i < count; ++i) {
+    observe(first_site + i, line, col, CBI_PAIR_SITE,
+            CBI_PAIR_LESS << ((packed >> (2 * i)) & 3), names[i]);
+  }
+}
+
+/*
+ * Sampling support for binaries built with -cbi-sampling.
+ *
+ * The fast copy of a function subtracts the sites it passes from the
+ * thread-local __cbi_countdown__, and only the slow copy calls
+ * __cbi_sample_branch__, __cbi_sample_return__ and __cbi_sample_pairs__,
+ * which count down one site at a time. CBI_SAMPLE_RATE (default 100) is
+ * the mean number of site executions per sample. Countdowns are drawn
+ * from a geometric distribution, so every execution is sampled
+ * independently with probability 1/rate. A countdown of zero means that
+ * the thread has not drawn one yet.
+ */
+__thread int __cbi_countdown__ = 0;
+
+static int sample_rate = 1;
+static pthread_once_t sampling_init_once = PTHREAD_ONCE_INIT;
+static __thread unsigned long long sample_rng_state = 0;
+
+static void init_sampling(void) {
+  const char *rate = getenv("CBI_SAMPLE_RATE");
+  sample_rate = rate ? atoi(rate) : 100;
+  if (sample_rate < 1) {
+    sample_rate = 1;
+  }
+}
+
+static double sample_uniform(void) {
+  sample_rng_state ^= sample_rng_state << 13;
+  sample_rng_state ^= sample_rng_state >> 7;
+  sample_rng_state ^= sample_rng_state << 17;
+  return ((sample_rng_state >> 11) + 0.5) / (double)(1ULL << 53);
+}
+
+/* Number of site executions up to and including the next sampled one. */
+static int next_countdown(void) {
+  if (sample_rate == 1) {
+    return 1;
+  }
+  double gap = log(sample_uniform()) / log(1.0 - 1.0 / sample_rate);
+  return gap >= INT32_MAX ? INT32_MAX : (int)gap + 1;
+}
+
+/* Count down one site and return whether it is sampled. */
+static int sample_site(void) {
+  if (__cbi_countdown__ <= 0) {
+    pthread_once(&sampling_init_once, init_sampling);
+    sample_rng_state = ((unsigned long long)time(NULL) << 32) ^ getpid() ^
+                       (unsigned long long)pthread_self() ^
+                       0x9e3779b97f4a7c15ULL;
+    __cbi_countdown__ = next_countdown();
+  }
+  if (--__cbi_countdown__ > 0) {
+    return 0;
+  }
+  __cbi_countdown__ = next_countdown();
+  return 1;
+}
+
+void __cbi_sample_branch__(int site, int line, int col, int cond) {
+  if (sample_site()) {
+    __cbi_branch__(site, line, col, cond);
+  }
+}
+
+void __cbi_sample_return__(int site, int line, int col, int rv) {
+  if (sample_site()) {
+    __cbi_return__(site, line, col, rv);
+  }
+}
+
+void __cbi_sample_pairs__(int first_site, int line, int col, int count,
+                          unsigned packed, const char **names) {
+  for (int i = 0; i < count; ++i) {
+    if (sample_site()) {
+      __cbi_pairs__(first_site + i, line, col, 1, packed >> (2 * i),
+                    names + i);
+    }
+  }
 }
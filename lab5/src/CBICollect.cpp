@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <spawn.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include "CBIMatrix.h"
+
+extern char **environ;
+
+/// One execution of the target and the sites it observed.
+struct Run {
+  std::string Input;
+  bool Failed;
+  int Status;
+  std::vector<cbi_site> Sites;
+  std::string Names;
+
+  const char *name(const cbi_site &Site) const {
+    return Site.name < Names.size() ? &Names[Site.name] : "";
+  }
+};
+
+/**
+ * @brief Add a run for every input file of Dir, sorted by name. Like the
+ * fuzzer, only files named input* without an extension are inputs.
+ */
+void collectInputs(const std::string &Dir, bool Failed,
+                   std::vector<Run> &Runs) {
+  std::vector<std::string> Found;
+  DIR *Directory = opendir(Dir.c_str());
+  if (Directory == NULL) {
+    return;
+  }
+  struct dirent *Ent;
+  while ((Ent = readdir(Directory)) != NULL) {
+    std::string Name(Ent->d_name);
+    std::string Path = Dir + "/" + Name;
+    struct stat Buffer;
+    if (Name.rfind("input", 0) == 0 && Name.find('.') == std::string::npos &&
+        stat(Path.c_str(), &Buffer) == 0 && S_ISREG(Buffer.st_mode)) {
+      Found.push_back(Path);
+    }
+  }
+  closedir(Directory);
+  std::sort(Found.begin(), Found.end());
+  for (auto &Path : Found) {
+    Runs.push_back({Path, Failed, -1, {}, {}});
+  }
+}
+
+/**
+ * @brief Run Target with the input of R on its stdin and read back the
+ * predicate record it leaves at RecordPath.
+ *
+ * @return int 0 on success.
+ */
+int runTarget(const std::string &Target, const std::string &RecordPath,
+              Run &R) {
+  unlink(RecordPath.c_str());
+
+  std::vector<std::string> Env;
+  for (char **Var = environ; *Var != NULL; ++Var) {
+    if (strncmp(*Var, CBI_RECORD_ENV "=", strlen(CBI_RECORD_ENV) + 1)) {
+      Env.push_back(*Var);
+    }
+  }
+  Env.push_back(std::string(CBI_RECORD_ENV "=") + RecordPath);
+  std::vector<char *> Envp;
+  for (auto &Var : Env) {
+    Envp.push_back(&Var[0]);
+  }
+  Envp.push_back(NULL);
+  char *Argv[] = {const_cast<char *>(Target.c_str()), NULL};
+
+  posix_spawn_file_actions_t Actions;
+  posix_spawn_file_actions_init(&Actions);
+  posix_spawn_file_actions_addopen(&Actions, 0, R.Input.c_str(), O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&Actions, 1, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_addopen(&Actions, 2, "/dev/null", O_WRONLY, 0);
+  pid_t Pid;
+  int Error = posix_spawn(&Pid, Target.c_str(), &Actions, NULL, Argv,
+                          Envp.data());
+  posix_spawn_file_actions_destroy(&Actions);
+  if (Error) {
+    fprintf(stderr, "Cannot run %s: %s\n", Target.c_str(), strerror(Error));
+    return 1;
+  }
+  int Status;
+  if (waitpid(Pid, &Status, 0) == -1) {
+    return 1;
+  }
+  R.Status = WIFEXITED(Status) ? WEXITSTATUS(Status) : 128 + WTERMSIG(Status);
+
+  FILE *Record = fopen(RecordPath.c_str(), "rb");
+  if (Record == NULL) {
+    // The run reached no site.
+    return 0;
+  }
+  cbi_header Header;
+  if (fread(&Header, sizeof(Header), 1, Record) == 1 &&
+      Header.magic == CBI_RECORD_MAGIC) {
+    R.Sites.resize(Header.num_sites);
+    R.Sites.resize(
+        fread(R.Sites.data(), sizeof(cbi_site), Header.num_sites, Record));
+    R.Names.resize(Header.names_size);
+    R.Names.resize(fread(&R.Names[0], 1, Header.names_size, Record));
+    // Names are NUL-terminated even if the record is cut short.
+    R.Names.push_back(0);
+  }
+  fclose(Record);
+  return 0;
+}
+
+/**
+ * @brief Write the predicate matrix of Runs to OutPath.
+ *
+ * @return int 0 on success.
+ */
+int writeMatrix(const std::string &OutPath, const std::vector<Run> &Runs) {
+  // Number sites in a stable order, so equal runs give equal matrices.
+  using SiteKey = std::tuple<int, int, int, std::string>;
+  std::map<SiteKey, uint32_t> SiteIndex;
+  for (auto &R : Runs) {
+    for (auto &Site : R.Sites) {
+      SiteIndex.emplace(
+          std::make_tuple(Site.line, Site.col, Site.kind, R.name(Site)), 0);
+    }
+  }
+  std::vector<cbi_matrix_site> Sites;
+  std::string Names(1, 0);
+  for (auto &Entry : SiteIndex) {
+    Entry.second = Sites.size();
+    cbi_matrix_site Site = {};
+    std::string Name;
+    std::tie(Site.line, Site.col, Site.kind, Name) = Entry.first;
+    if (!Name.empty()) {
+      Site.name = Names.size();
+      Names += Name;
+      Names.push_back(0);
+    }
+    Sites.push_back(Site);
+  }
+
+  std::vector<cbi_matrix_run> MatrixRuns;
+  std::vector<cbi_matrix_entry> Entries;
+  for (auto &R : Runs) {
+    cbi_matrix_run MatrixRun = {};
+    MatrixRun.first_entry = Entries.size();
+    MatrixRun.failed = R.Failed;
+    for (auto &Site : R.Sites) {
+      cbi_matrix_entry Entry = {};
+      Entry.site = SiteIndex[std::make_tuple(Site.line, Site.col, Site.kind,
+                                             R.name(Site))];
+      Entry.bits = Site.bits;
+      Entries.push_back(Entry);
+    }
+    MatrixRun.num_entries = Entries.size() - MatrixRun.first_entry;
+    MatrixRuns.push_back(MatrixRun);
+  }
+
+  FILE *Out = fopen(OutPath.c_str(), "wb");
+  if (Out == NULL) {
+    fprintf(stderr, "Cannot write %s\n", OutPath.c_str());
+    return 1;
+  }
+  cbi_matrix_header Header = {};
+  Header.magic = CBI_MATRIX_MAGIC;
+  Header.num_sites = Sites.size();
+  Header.num_runs = MatrixRuns.size();
+  Header.names_size = Names.size();
+  Header.num_entries = Entries.size();
+  fwrite(&Header, sizeof(Header), 1, Out);
+  fwrite(Sites.data(), sizeof(cbi_matrix_site), Sites.size(), Out);
+  fwrite(MatrixRuns.data(), sizeof(cbi_matrix_run), MatrixRuns.size(), Out);
+  fwrite(Entries.data(), sizeof(cbi_matrix_entry), Entries.size(), Out);
+  fwrite(Names.data(), 1, Names.size(), Out);
+  return fclose(Out) ? 1 : 0;
+}
+
+/**
+ * Run a CBI-instrumented target on every input in the success/ and
+ * failure/ directories of a fuzzer output on a pool of worker processes,
+ * and combine their predicate records into a single matrix. Each worker
+ * points the runtime to its own record file through CBI_RECORD. As in
+ * cbi, successful inputs must exit with 0 and failing ones with 1.
+ *
+ * Usage:
+ * ./cbi-collect (-j jobs) [target] [fuzzer-output-dir] (output file)
+ */
+int main(int argc, char **argv) {
+  unsigned Jobs = std::max(1u, std::thread::hardware_concurrency());
+  int First = 1;
+  if (argc > 2 && std::string(argv[1]) == "-j") {
+    Jobs = std::max(1l, strtol(argv[2], NULL, 10));
+    First = 3;
+  }
+  if (argc - First < 2) {
+    fprintf(stderr,
+            "usage: %s (-j jobs) [target] [fuzzer-output-dir] (output file)\n",
+            argv[0]);
+    return 1;
+  }
+  std::string Target(argv[First]);
+  std::string FuzzDir(argv[First + 1]);
+  std::string OutPath =
+      argc - First > 2 ? argv[First + 2] : Target + CBI_MATRIX_EXTENSION;
+  if (access(Target.c_str(), X_OK)) {
+    fprintf(stderr, "%s not found\n", Target.c_str());
+    return 1;
+  }
+
+  std::vector<Run> Runs;
+  collectInputs(FuzzDir + "/success", false, Runs);
+  collectInputs(FuzzDir + "/failure", true, Runs);
+
+  char TempDir[] = "/tmp/cbi-collect-XXXXXX";
+  if (mkdtemp(TempDir) == NULL) {
+    fprintf(stderr, "Cannot create a temporary directory\n");
+    return 1;
+  }
+
+  std::atomic<size_t> Next{0};
+  std::atomic<bool> Failed{false};
+  std::vector<std::thread> Workers;
+  for (unsigned I = 0; I < std::min<size_t>(Jobs, Runs.size()); ++I) {
+    Workers.emplace_back([&, I]() {
+      std::string RecordPath =
+          std::string(TempDir) + "/worker" + std::to_string(I) +
+          CBI_RECORD_EXTENSION;
+      for (size_t R = Next++; R < Runs.size() && !Failed; R = Next++) {
+        if (runTarget(Target, RecordPath, Runs[R])) {
+          Failed = true;
+        }
+      }
+      unlink(RecordPath.c_str());
+    });
+  }
+  for (auto &Worker : Workers) {
+    Worker.join();
+  }
+  rmdir(TempDir);
+  if (Failed) {
+    return 1;
+  }
+
+  for (auto &R : Runs) {
+    int Expected = R.Failed ? 1 : 0;
+    if (R.Status != Expected) {
+      fprintf(stderr, "%s: return code %d didn't match expected value: %d\n",
+              R.Input.c_str(), R.Status, Expected);
+      return 1;
+    }
+  }
+
+  if (writeMatrix(OutPath, Runs)) {
+    return 1;
+  }
+  fprintf(stderr, "Collected %zu runs into %s\n", Runs.size(),
+          OutPath.c_str());
+  return 0;
+}
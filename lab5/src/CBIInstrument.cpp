@@ -1,5 +1,19 @@
 #include "CBIInstrument.h"
 
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+
 using namespace llvm;
 
 namespace instrument {
@@ -8,29 +22,290 @@ const auto PASS_NAME = "CBIInstrument";
 const auto PASS_DESC = "Instrumentation for CBI";
 const auto CBI_BRANCH_FUNCTION_NAME = "__cbi_branch__";
 const auto CBI_RETURN_FUNCTION_NAME = "__cbi_return__";
+const auto CBI_SAMPLE_BRANCH_FUNCTION_NAME = "__cbi_sample_branch__";
+const auto CBI_SAMPLE_RETURN_FUNCTION_NAME = "__cbi_sample_return__";
+const auto CBI_PAIRS_FUNCTION_NAME = "__cbi_pairs__";
+const auto CBI_SAMPLE_PAIRS_FUNCTION_NAME = "__cbi_sample_pairs__";
+const auto CBI_COUNTDOWN_VARIABLE_NAME = "__cbi_countdown__";
+const auto CBI_REGISTER_SITES_FUNCTION_NAME = "__cbi_register_sites__";
+const auto SITE_BASE_VARIABLE_NAME = "__cbi_site_base";
+const auto NUM_SITES_VARIABLE_NAME = "__cbi_num_sites";
+const auto REGISTER_SITES_CONSTRUCTOR_NAME = "__cbi_register_module_sites";
+
+/**
+ * When set, functions are split into a fast copy that only counts down to
+ * the next sample and a slow copy that checks every site, and control
+ * moves between the two at the boundaries of acyclic regions. The mean
+ * sampling period is set at run time by CBI_SAMPLE_RATE.
+ */
+static cl::opt<bool> Sampling("cbi-sampling",
+                              cl::desc("Sample CBI predicates sparsely"),
+                              cl::init(false));
+
+/**
+ * Adaptive bug isolation re-instruments a target in rounds. The first
+ * round sets -cbi-coarse, which keeps only the return value sites, and
+ * every later round passes the functions that held suspicious predicates
+ * in -cbi-functions, so that only they and their neighbors in the call
+ * graph get any sites. -cbi-site-map tells which function a site is in.
+ */
+static cl::opt<bool> Coarse("cbi-coarse",
+                            cl::desc("Instrument return values only"),
+                            cl::init(false));
+
+static cl::opt<std::string>
+    FunctionList("cbi-functions",
+                 cl::desc("File with the names of the functions to "
+                          "instrument, along with their callers and callees"),
+                 cl::value_desc("filename"));
+
+static cl::opt<std::string>
+    SiteMap("cbi-site-map",
+            cl::desc("File to write the line, column and function of "
+                     "every site to"),
+            cl::value_desc("filename"));
+
+/**
+ * The scalar-pairs scheme compares the value stored to a local variable
+ * with other local variables, and has a site for each pair. To keep the
+ * number of sites in check, only user variables of the same integer type
+ * that are in scope and declared no later than the store are compared,
+ * and at most -cbi-max-pairs of them, the most recently declared first.
+ */
+static cl::opt<bool> ScalarPairs("cbi-scalar-pairs",
+                                 cl::desc("Instrument scalar pairs"),
+                                 cl::init(false));
+
+static cl::opt<unsigned>
+    MaxPairs("cbi-max-pairs",
+             cl::desc("Largest number of variables a store is compared "
+                      "with, at most 16"),
+             cl::init(8));
+
+/// A branch, call or store to instrument, with its site ID in the module
+/// and location. A store is compared with each of Others, and these pairs
+/// are the sites Id, Id + 1 and so on. Unsigned is set when the compared
+/// variables are unsigned.
+struct Site {
+  Instruction *Inst;
+  int Id;
+  int Line;
+  int Col;
+  std::vector<std::pair<AllocaInst *, std::string>> Others;
+  bool Unsigned = false;
+
+  int count() const { return Others.empty() ? 1 : Others.size(); }
+};
+
+/**
+ * @brief Reserve Count site IDs of M
+ *
+ * Several modules of a program are instrumented separately, so site IDs
+ * are numbered from 0 in each of them. The first site of M adds a
+ * constructor that registers the number of sites of M, kept in a private
+ * global, with __cbi_register_sites__, and stores the start of the range
+ * of IDs it gets in another one. See siteId.
+ *
+ * @return The first of the IDs in M
+ */
+int reserveSites(Module *M, int Count);
+
+/**
+ * @brief Compute the ID of site Id of M, before InsertBefore
+ *
+ * @return The start of the range of IDs of M plus Id, so that the sites
+ * of different modules never share an ID in the predicate table.
+ */
+Value *siteId(Module *M, int Id, Instruction *InsertBefore);
 
 /**
  * @brief Instrument a BranchInst with calls to __cbi_branch__
  *
  * @param M Module containing Branch
  * @param Branch A conditional Branch Instruction
+ * @param Site Site ID of Branch in M
  * @param Line Line number of Branch
  * @param Col Coulmn number of Branch
+ * @param Hook Runtime function to call, __cbi_branch__ by default
  */
-void instrumentBranch(Module *M, BranchInst *Branch, int Line, int Col);
+void instrumentBranch(Module *M, BranchInst *Branch, int Site, int Line,
+                      int Col, StringRef Hook = CBI_BRANCH_FUNCTION_NAME);
 
 /**
  * @brief Instrument the return value of CallInst using calls to __cbi_return__
  *
  * @param M Module containing Call
  * @param Call A Call instruction that returns an Int32.
+ * @param Site Site ID of Call in M
  * @param Line Line number of the Call
  * @param Col Column number of the Call
+ * @param Hook Runtime function to call, __cbi_return__ by default
+ */
+void instrumentReturn(Module *M, CallInst *Call, int Site, int Line, int Col,
+                      StringRef Hook = CBI_RETURN_FUNCTION_NAME);
+
+/**
+ * @brief Instrument the pairs of a store with a call to __cbi_pairs__
+ *
+ * @param M Module containing Store
+ * @param Store A store to a local variable
+ * @param S Site of Store, with the variables it is compared with
+ * @param Hook Runtime function to call, __cbi_pairs__ by default
+ */
+void instrumentPairs(Module *M, StoreInst *Store, const Site &S,
+                     StringRef Hook = CBI_PAIRS_FUNCTION_NAME);
+
+/**
+ * @brief Instrument Sites of F for sparse sampling
+ *
+ * @param F A function with at least one site
+ * @param Sites The branches and calls of F to instrument
  */
-void instrumentReturn(Module *M, CallInst *Call, int Line, int Col);
+void instrumentSampled(Function &F, std::vector<Site> &Sites);
+
+/**
+ * @brief Check whether F is in the region selected by -cbi-functions
+ *
+ * @param F A function of the module
+ * @return true if no list is given, or if F, one of its callers or one of
+ * its callees is on the list
+ */
+bool isSelected(Function &F) {
+  static std::unique_ptr<StringSet<>> Selected;
+  if (FunctionList.empty()) {
+    return true;
+  }
+  if (!Selected) {
+    Selected.reset(new StringSet<>());
+    auto Buffer = MemoryBuffer::getFile(FunctionList);
+    if (!Buffer) {
+      report_fatal_error("Cannot read " + Twine(FunctionList));
+    }
+    for (line_iterator Line(**Buffer); !Line.is_at_eof(); ++Line) {
+      Selected->insert(Line->trim());
+    }
+  }
+
+  if (Selected->count(F.getName())) {
+    return true;
+  }
+  for (auto *U : F.users()) {
+    auto *Call = dyn_cast<CallInst>(U);
+    if (Call && Selected->count(Call->getFunction()->getName())) {
+      return true;
+    }
+  }
+  for (auto &Inst : instructions(F)) {
+    auto *Call = dyn_cast<CallInst>(&Inst);
+    auto *Callee = Call ? Call->getCalledFunction() : nullptr;
+    if (Callee && Selected->count(Callee->getName())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Write the location and function of Sites to -cbi-site-map, one
+ * "line column function" per line
+ */
+void writeSiteMap(Function &F, const std::vector<Site> &Sites) {
+  static FILE *Out = nullptr;
+  if (SiteMap.empty()) {
+    return;
+  }
+  if (!Out && !(Out = fopen(SiteMap.c_str(), "w"))) {
+    report_fatal_error("Cannot write " + Twine(SiteMap));
+  }
+  for (auto &S : Sites) {
+    fprintf(Out, "%d %d %s\n", S.Line, S.Col, F.getName().str().c_str());
+  }
+  fflush(Out);
+}
+
+/**
+ * @brief Check whether Var is visible at Loc
+ */
+bool isInScope(DILocalVariable *Var, const DebugLoc &Loc) {
+  if (Var->getLine() > Loc.getLine()) {
+    return false;
+  }
+  for (auto *Scope = cast<DILocalScope>(Loc.getScope()); Scope;) {
+    if (Scope == Var->getScope()) {
+      return true;
+    }
+    auto *Block = dyn_cast<DILexicalBlockBase>(Scope);
+    Scope = Block ? Block->getScope() : nullptr;
+  }
+  return false;
+}
+
+/**
+ * @brief Check whether Var is an unsigned integer or a boolean, looking
+ * through typedefs, qualifiers and enumerations
+ *
+ * @param Var A user variable
+ * @return true if comparisons of Var are unsigned
+ */
+bool isUnsigned(DILocalVariable *Var) {
+  auto *Type = Var->getType();
+  while (Type) {
+    if (auto *Basic = dyn_cast<DIBasicType>(Type)) {
+      auto Encoding = Basic->getEncoding();
+      return Encoding == dwarf::DW_ATE_unsigned ||
+             Encoding == dwarf::DW_ATE_unsigned_char ||
+             Encoding == dwarf::DW_ATE_boolean;
+    } else if (auto *Derived = dyn_cast<DIDerivedType>(Type)) {
+      Type = Derived->getBaseType();
+    } else if (auto *Composite = dyn_cast<DICompositeType>(Type)) {
+      Type = Composite->getBaseType();
+    } else {
+      break;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Select the variables that a store to a user variable is compared
+ * with, and name each pair "assigned compared". Variables that differ in
+ * signedness are not compared.
+ *
+ * @param Store A store instruction with debug information
+ * @param Variables The user variables of the function
+ * @return The variables, at most -cbi-max-pairs of them
+ */
+std::vector<std::pair<AllocaInst *, std::string>>
+pairsOf(StoreInst *Store,
+        const MapVector<AllocaInst *, DILocalVariable *> &Variables) {
+  std::vector<std::pair<AllocaInst *, std::string>> Others;
+  auto *Assigned = dyn_cast<AllocaInst>(Store->getPointerOperand());
+  auto Iter = Variables.find(Assigned);
+  if (!Assigned || Iter == Variables.end()) {
+    return Others;
+  }
+  auto Limit = std::min(MaxPairs.getValue(), 16u);
+  bool Unsigned = isUnsigned(Iter->second);
+  // Later declarations come first, as they are the closest to the store.
+  for (auto Other = Variables.rbegin(), E = Variables.rend();
+       Other != E && Others.size() < Limit; ++Other) {
+    if (Other->first != Assigned &&
+        Other->first->getAllocatedType() == Assigned->getAllocatedType() &&
+        isUnsigned(Other->second) == Unsigned &&
+        isInScope(Other->second, Store->getDebugLoc())) {
+      Others.emplace_back(Other->first, (Iter->second->getName() + " " +
+                                         Other->second->getName())
+                                            .str());
+    }
+  }
+  return Others;
+}
 
 bool CBIInstrument::runOnFunction(Function &F) {
   auto FunctionName = F.getName().str();
+  if (!isSelected(F)) {
+    return false;
+  }
   outs() << "Running " << PASS_DESC << " on function " << FunctionName << "\n";
 
   LLVMContext &Context = F.getContext();
@@ -41,11 +316,45 @@ bool CBIInstrument::runOnFunction(Function &F) {
   Type *BoolType = Type::getInt1Ty(Context);
 
   M->getOrInsertFunction(CBI_BRANCH_FUNCTION_NAME, VoidType, Int32Type,
-                         Int32Type, BoolType);
+                         Int32Type, Int32Type, BoolType);
 
   M->getOrInsertFunction(CBI_RETURN_FUNCTION_NAME, VoidType, Int32Type,
-                         Int32Type, Int32Type);
+                         Int32Type, Int32Type, Int32Type);
+
+  if (Sampling) {
+    M->getOrInsertFunction(CBI_SAMPLE_BRANCH_FUNCTION_NAME, VoidType,
+                           Int32Type, Int32Type, Int32Type, BoolType);
+    M->getOrInsertFunction(CBI_SAMPLE_RETURN_FUNCTION_NAME, VoidType,
+                           Int32Type, Int32Type, Int32Type, Int32Type);
+    auto *Countdown = cast<GlobalVariable>(
+        M->getOrInsertGlobal(CBI_COUNTDOWN_VARIABLE_NAME, Int32Type));
+    Countdown->setThreadLocal(true);
+  }
 
+  if (ScalarPairs) {
+    Type *NamesType = Type::getInt8PtrTy(Context)->getPointerTo();
+    M->getOrInsertFunction(CBI_PAIRS_FUNCTION_NAME, VoidType, Int32Type,
+                           Int32Type, Int32Type, Int32Type, Int32Type,
+                           NamesType);
+    if (Sampling) {
+      M->getOrInsertFunction(CBI_SAMPLE_PAIRS_FUNCTION_NAME, VoidType,
+                             Int32Type, Int32Type, Int32Type, Int32Type,
+                             Int32Type, NamesType);
+    }
+  }
+
+  // User variables of F, in the order they are declared.
+  MapVector<AllocaInst *, DILocalVariable *> Variables;
+  for (auto &Inst : instructions(F)) {
+    auto *Declare = dyn_cast<DbgDeclareInst>(&Inst);
+    auto *Alloca = Declare ? dyn_cast_or_null<AllocaInst>(Declare->getAddress())
+                           : nullptr;
+    if (Alloca && Alloca->getAllocatedType()->isIntegerTy()) {
+      Variables[Alloca] = Declare->getVariable();
+    }
+  }
+
+  std::vector<Site> Sites;
   for (inst_iterator Iter = inst_begin(F), E = inst_end(F); Iter != E; ++Iter) {
     Instruction &Inst = (*Iter);
     llvm::DebugLoc DebugLoc = Inst.getDebugLoc();
@@ -57,44 +366,349 @@ bool CBIInstrument::runOnFunction(Function &F) {
     int Line = DebugLoc.getLine();
     int Col = DebugLoc.getCol();
 
-    /**
-     * TODO: Add code to check the type of instruction
-     * and call appropriate instrumentation function.
-     *
-     * If Inst is a Branch Instruction then
-     *   use instrumentBranch
-     * Else if it is a Call returning an int then
-     *   use instrumentReturn
-     * @param Branch
-     */
+    auto *Branch = dyn_cast<BranchInst>(&Inst);
+    auto *Call = dyn_cast<CallInst>(&Inst);
+    if ((Branch && Branch->isConditional() && !Coarse) ||
+        (Call && Call->getType() == Int32Type)) {
+      Sites.push_back({&Inst, reserveSites(M, 1), Line, Col});
+    }
+
+    auto *Store = dyn_cast<StoreInst>(&Inst);
+    if (Store && ScalarPairs && !Coarse) {
+      auto Others = pairsOf(Store, Variables);
+      if (!Others.empty()) {
+        auto *Assigned = cast<AllocaInst>(Store->getPointerOperand());
+        Sites.push_back({&Inst, reserveSites(M, Others.size()), Line, Col,
+                         Others, isUnsigned(Variables.lookup(Assigned))});
+      }
+    }
+  }
+  writeSiteMap(F, Sites);
+
+  if (Sampling) {
+    if (!Sites.empty()) {
+      instrumentSampled(F, Sites);
+    }
+    return true;
+  }
+
+  for (auto &S : Sites) {
+    if (auto *Branch = dyn_cast<BranchInst>(S.Inst)) {
+      instrumentBranch(M, Branch, S.Id, S.Line, S.Col);
+    } else if (auto *Store = dyn_cast<StoreInst>(S.Inst)) {
+      instrumentPairs(M, Store, S);
+    } else {
+      instrumentReturn(M, cast<CallInst>(S.Inst), S.Id, S.Line, S.Col);
+    }
   }
   return true;
 }
 
+int reserveSites(Module *M, int Count) {
+  auto &Context = M->getContext();
+  auto *Int32Type = Type::getInt32Ty(Context);
+  auto *Zero = ConstantInt::get(Int32Type, 0);
+
+  auto *NumSites = M->getGlobalVariable(NUM_SITES_VARIABLE_NAME, true);
+  if (!NumSites) {
+    NumSites = new GlobalVariable(*M, Int32Type, true,
+                                  GlobalValue::PrivateLinkage, Zero,
+                                  NUM_SITES_VARIABLE_NAME);
+    auto *SiteBase = new GlobalVariable(*M, Int32Type, false,
+                                        GlobalValue::PrivateLinkage, Zero,
+                                        SITE_BASE_VARIABLE_NAME);
+
+    M->getOrInsertFunction(CBI_REGISTER_SITES_FUNCTION_NAME, Int32Type,
+                           Int32Type);
+    auto *Constructor = Function::Create(
+        FunctionType::get(Type::getVoidTy(Context), false),
+        GlobalValue::InternalLinkage, REGISTER_SITES_CONSTRUCTOR_NAME, M);
+    IRBuilder<> Builder(BasicBlock::Create(Context, "entry", Constructor));
+    auto *Base =
+        Builder.CreateCall(M->getFunction(CBI_REGISTER_SITES_FUNCTION_NAME),
+                           {Builder.CreateLoad(Int32Type, NumSites)});
+    Builder.CreateStore(Base, SiteBase);
+    Builder.CreateRetVoid();
+    appendToGlobalCtors(*M, Constructor, 0);
+  }
+
+  auto First = cast<ConstantInt>(NumSites->getInitializer())->getZExtValue();
+  NumSites->setInitializer(ConstantInt::get(Int32Type, First + Count));
+  return First;
+}
+
+Value *siteId(Module *M, int Id, Instruction *InsertBefore) {
+  auto *Int32Type = Type::getInt32Ty(M->getContext());
+  auto *SiteBase = M->getGlobalVariable(SITE_BASE_VARIABLE_NAME, true);
+  IRBuilder<> Builder(InsertBefore);
+  return Builder.CreateAdd(Builder.CreateLoad(Int32Type, SiteBase),
+                           ConstantInt::get(Int32Type, Id));
+}
+
 /**
  * Implement instrumentation for the branch scheme of CBI.
  */
-void instrumentBranch(Module *M, BranchInst *Branch, int Line, int Col) {
+void instrumentBranch(Module *M, BranchInst *Branch, int Site, int Line,
+                      int Col, StringRef Hook) {
   auto &Context = M->getContext();
   auto Int32Type = Type::getInt32Ty(Context);
 
-  /**
-   * TODO: Add code to instrument the Branch Instruction.
-   */
+  auto SiteVal = siteId(M, Site, Branch);
+  auto LineVal = ConstantInt::get(Int32Type, Line);
+  auto ColVal = ConstantInt::get(Int32Type, Col);
+
+  std::vector<Value *> Args = {SiteVal, LineVal, ColVal,
+                               Branch->getCondition()};
+
+  auto *BranchFunction = M->getFunction(Hook);
+  CallInst::Create(BranchFunction, Args, "", Branch);
 }
 
 /**
  * Implement instrumentation for the return scheme of CBI.
  */
-void instrumentReturn(Module *M, CallInst *Call, int Line, int Col) {
+void instrumentReturn(Module *M, CallInst *Call, int Site, int Line, int Col,
+                      StringRef Hook) {
   auto &Context = M->getContext();
   auto Int32Type = Type::getInt32Ty(Context);
 
-  /**
-   * TODO: Add code to instrument the Call Instruction.
-   *
-   * Note: CallInst::Create(.) follows Insert Before semantics.
-   */
+  auto *Next = Call->getNextNode();
+  auto SiteVal = siteId(M, Site, Next);
+  auto LineVal = ConstantInt::get(Int32Type, Line);
+  auto ColVal = ConstantInt::get(Int32Type, Col);
+
+  std::vector<Value *> Args = {SiteVal, LineVal, ColVal, Call};
+
+  auto *ReturnFunction = M->getFunction(Hook);
+  CallInst::Create(ReturnFunction, Args, "", Next);
+}
+
+/**
+ * Implement instrumentation for the scalar-pairs scheme of CBI.
+ *
+ * The outcome of each comparison is packed into two bits of a single
+ * argument, 0 for <, 1 for = and 2 for >, so a store takes one call to
+ * the runtime however many variables it is compared with.
+ */
+void instrumentPairs(Module *M, StoreInst *Store, const Site &S,
+                     StringRef Hook) {
+  auto &Context = M->getContext();
+  auto *Int32Type = Type::getInt32Ty(Context);
+  auto *Int8PtrType = Type::getInt8PtrTy(Context);
+
+  std::vector<Constant *> Names;
+  for (auto &Other : S.Others) {
+    auto *Name = ConstantDataArray::getString(Context, Other.second);
+    auto *NameVar = new GlobalVariable(*M, Name->getType(), true,
+                                       GlobalValue::PrivateLinkage, Name);
+    NameVar->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    Names.push_back(ConstantExpr::getPointerCast(NameVar, Int8PtrType));
+  }
+  auto *NamesType = ArrayType::get(Int8PtrType, Names.size());
+  auto *NamesVar =
+      new GlobalVariable(*M, NamesType, true, GlobalValue::PrivateLinkage,
+                         ConstantArray::get(NamesType, Names));
+
+  IRBuilder<> Builder(Store->getNextNode());
+  auto *Assigned = Store->getValueOperand();
+  Value *Packed = ConstantInt::get(Int32Type, 0);
+  for (unsigned I = 0; I < S.Others.size(); ++I) {
+    auto *Other = Builder.CreateLoad(Assigned->getType(), S.Others[I].first);
+    auto *Greater = S.Unsigned ? Builder.CreateICmpUGT(Assigned, Other)
+                               : Builder.CreateICmpSGT(Assigned, Other);
+    auto *Code = Builder.CreateSelect(
+        Greater, ConstantInt::get(Int32Type, 2),
+        Builder.CreateZExt(Builder.CreateICmpEQ(Assigned, Other), Int32Type));
+    Packed = Builder.CreateOr(Packed, Builder.CreateShl(Code, 2 * I));
+  }
+
+  std::vector<Value *> Args = {
+      siteId(M, S.Id, Store->getNextNode()),
+      ConstantInt::get(Int32Type, S.Line),
+      ConstantInt::get(Int32Type, S.Col),
+      ConstantInt::get(Int32Type, S.Others.size()),
+      Packed,
+      Builder.CreateConstInBoundsGEP2_32(NamesType, NamesVar, 0, 0)};
+  Builder.CreateCall(M->getFunction(Hook), Args);
+}
+
+/**
+ * Sparse sampling in the style of Liblit et al.
+ *
+ * Regions start at the function entry, at loop headers and right after
+ * calls, since a callee may use up any part of the countdown. A head block
+ * in front of each region checks the thread-local countdown: if it exceeds
+ * the largest number of sites on any path through the acyclic region, no
+ * sample can fall in it and control goes to the fast copy of the region,
+ * which only subtracts the sites it passes, one block at a time. Otherwise
+ * it goes to the slow copy, where every site calls the runtime to count
+ * down and record the predicate when the countdown expires.
+ */
+void instrumentSampled(Function &F, std::vector<Site> &Sites) {
+  Module *M = F.getParent();
+  auto &Context = M->getContext();
+  auto *Int32Type = Type::getInt32Ty(Context);
+  auto *Countdown = M->getGlobalVariable(CBI_COUNTDOWN_VARIABLE_NAME);
+
+  // Split a head block off the start of every region. Allocas stay in the
+  // entry head, which is not cloned.
+  std::vector<std::pair<BasicBlock *, BasicBlock *>> Regions;
+  auto &Entry = F.getEntryBlock();
+  auto EntryPoint = Entry.getFirstInsertionPt();
+  while (isa<AllocaInst>(*EntryPoint)) {
+    ++EntryPoint;
+  }
+  Regions.emplace_back(&Entry, SplitBlock(&Entry, &*EntryPoint));
+
+  SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 8> BackEdges;
+  FindFunctionBackedges(F, BackEdges);
+  SmallPtrSet<BasicBlock *, 8> LoopHeaders;
+  for (auto &Edge : BackEdges) {
+    LoopHeaders.insert(const_cast<BasicBlock *>(Edge.second));
+  }
+  for (auto *Header : LoopHeaders) {
+    Regions.emplace_back(Header, SplitBlock(Header, Header->getFirstNonPHI()));
+  }
+
+  // Runtime hooks such as __coverage__ leave the countdown alone.
+  std::vector<CallInst *> Calls;
+  for (auto &I : instructions(F)) {
+    auto *Call = dyn_cast<CallInst>(&I);
+    if (!Call || isa<IntrinsicInst>(Call)) {
+      continue;
+    }
+    auto *Callee = Call->getCalledFunction();
+    if (Callee && Callee->getName().startswith("__") &&
+        Callee->getName().endswith("__")) {
+      continue;
+    }
+    Calls.push_back(Call);
+  }
+  for (auto *Call : Calls) {
+    auto *Head = Call->getParent();
+    Regions.emplace_back(Head, SplitBlock(Head, Call->getNextNode()));
+  }
+
+  // The weight of a block is the largest number of sites on a path from it
+  // to the end of its region. A return site belongs to the region of its
+  // call, as it is recorded before the check that follows the call.
+  DenseMap<BasicBlock *, int> SiteCount;
+  for (auto &S : Sites) {
+    SiteCount[S.Inst->getParent()] += S.count();
+  }
+  SmallPtrSet<BasicBlock *, 16> Heads;
+  for (auto &Region : Regions) {
+    Heads.insert(Region.first);
+  }
+  DenseMap<BasicBlock *, int> Weight;
+  std::function<int(BasicBlock *)> getWeight = [&](BasicBlock *BB) {
+    auto Iter = Weight.find(BB);
+    if (Iter != Weight.end()) {
+      return Iter->second;
+    }
+    // Guards against cycles in unreachable code, which have no head.
+    Weight[BB] = SiteCount.lookup(BB);
+    int Max = 0;
+    if (!Heads.count(BB)) {
+      for (auto *Succ : successors(BB)) {
+        Max = std::max(Max, getWeight(Succ));
+      }
+    }
+    return Weight[BB] = SiteCount.lookup(BB) + Max;
+  };
+  std::vector<int> Limits;
+  for (auto &Region : Regions) {
+    Limits.push_back(getWeight(Region.second));
+  }
+
+  // Clone everything but the entry head into the slow copy.
+  ValueToValueMapTy VMap;
+  std::vector<BasicBlock *> Blocks;
+  std::vector<Instruction *> Insts;
+  for (auto &BB : F) {
+    if (&BB != &Entry) {
+      Blocks.push_back(&BB);
+    }
+  }
+  for (auto *BB : Blocks) {
+    VMap[BB] = CloneBasicBlock(BB, VMap, ".slow", &F);
+    for (auto &I : *BB) {
+      if (!I.getType()->isVoidTy()) {
+        Insts.push_back(&I);
+      }
+    }
+  }
+  for (auto *BB : Blocks) {
+    for (auto &I : *cast<BasicBlock>(VMap[BB])) {
+      RemapInstruction(&I, VMap,
+                       RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+    }
+  }
+
+  for (auto &Count : SiteCount) {
+    IRBuilder<> Builder(&*Count.first->getFirstInsertionPt());
+    auto *Current = Builder.CreateLoad(Int32Type, Countdown);
+    auto *Next =
+        Builder.CreateSub(Current, ConstantInt::get(Int32Type, Count.second));
+    Builder.CreateStore(Next, Countdown);
+  }
+  for (auto &S : Sites) {
+    auto *Slow = cast<Instruction>(VMap[S.Inst]);
+    if (auto *Branch = dyn_cast<BranchInst>(Slow)) {
+      instrumentBranch(M, Branch, S.Id, S.Line, S.Col,
+                       CBI_SAMPLE_BRANCH_FUNCTION_NAME);
+    } else if (auto *Store = dyn_cast<StoreInst>(Slow)) {
+      instrumentPairs(M, Store, S, CBI_SAMPLE_PAIRS_FUNCTION_NAME);
+    } else {
+      instrumentReturn(M, cast<CallInst>(Slow), S.Id, S.Line, S.Col,
+                       CBI_SAMPLE_RETURN_FUNCTION_NAME);
+    }
+  }
+
+  auto *Weights = MDBuilder(Context).createBranchWeights(1 << 10, 1);
+  for (unsigned I = 0; I < Regions.size(); ++I) {
+    auto *Body = Regions[I].second;
+    auto *SlowBody = cast<BasicBlock>(VMap[Body]);
+    auto *Limit = ConstantInt::get(Int32Type, Limits[I]);
+
+    std::vector<BasicBlock *> RegionHeads = {Regions[I].first};
+    if (VMap.count(Regions[I].first)) {
+      RegionHeads.push_back(cast<BasicBlock>(VMap[Regions[I].first]));
+    }
+    for (auto *Head : RegionHeads) {
+      auto *Term = Head->getTerminator();
+      IRBuilder<> Builder(Term);
+      auto *Current = Builder.CreateLoad(Int32Type, Countdown);
+      auto *Fast = Builder.CreateICmpSGT(Current, Limit);
+      Builder.CreateCondBr(Fast, Body, SlowBody, Weights);
+      Term->eraseFromParent();
+    }
+  }
+
+  // Both copies now flow into each other, so values used outside their
+  // block may come from either one.
+  for (auto *I : Insts) {
+    auto *Clone = cast<Instruction>(VMap[I]);
+    SmallVector<Use *, 8> Uses;
+    for (auto *Def : {I, Clone}) {
+      for (auto &U : Def->uses()) {
+        auto *User = cast<Instruction>(U.getUser());
+        if (isa<PHINode>(User) || User->getParent() != Def->getParent()) {
+          Uses.push_back(&U);
+        }
+      }
+    }
+    if (Uses.empty()) {
+      continue;
+    }
+    SSAUpdater SSA;
+    SSA.Initialize(I->getType(), I->getName());
+    SSA.AddAvailableValue(I->getParent(), I);
+    SSA.AddAvailableValue(Clone->getParent(), Clone);
+    for (auto *U : Uses) {
+      SSA.RewriteUse(*U);
+    }
+  }
 }
 
 char CBIInstrument::ID = 1;
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "CBIMatrix.h"
+
+const char *BRANCH_TYPES[] = {"BranchTrue", "BranchFalse"};
+const char *RETURN_TYPES[] = {"ReturnPositive", "ReturnZero", "ReturnNegative"};
+const char *PAIR_OPERATORS[] = {"<", "==", ">"};
+
+/// A predicate of a site. Predicate K of a site is true in a run when
+/// bit 1 << (K + 1) of the site's entry is set.
+struct Predicate {
+  uint32_t Site;
+  int Line;
+  int Col;
+  std::string Type;
+  uint64_t S = 0;
+  uint64_t F = 0;
+  uint64_t SObs = 0;
+  uint64_t FObs = 0;
+
+  double failure() const { return S + F == 0 ? 0.0 : (double)F / (S + F); }
+  double context() const {
+    return SObs + FObs == 0 ? 0.0 : (double)FObs / (SObs + FObs);
+  }
+  double increase() const { return failure() - context(); }
+};
+
+uint64_t popcountAndScalar(const uint64_t *A, const uint64_t *B,
+                           size_t Words) {
+  uint64_t Count = 0;
+  for (size_t I = 0; I < Words; ++I) {
+    Count += __builtin_popcountll(A[I] & B[I]);
+  }
+  return Count;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Population count of A & B, 256 bits at a time. Each nibble is
+ * counted with a table lookup through vpshufb and the byte counts are
+ * summed with vpsadbw.
+ */
+__attribute__((target("avx2"))) uint64_t
+popcountAndAVX2(const uint64_t *A, const uint64_t *B, size_t Words) {
+  const __m256i Lookup =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i LowNibble = _mm256_set1_epi8(0x0f);
+  __m256i Total = _mm256_setzero_si256();
+  size_t I = 0;
+  for (; I + 4 <= Words; I += 4) {
+    __m256i V = _mm256_and_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(A + I)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(B + I)));
+    __m256i Low = _mm256_shuffle_epi8(Lookup, _mm256_and_si256(V, LowNibble));
+    __m256i High = _mm256_shuffle_epi8(
+        Lookup, _mm256_and_si256(_mm256_srli_epi16(V, 4), LowNibble));
+    Total = _mm256_add_epi64(
+        Total, _mm256_sad_epu8(_mm256_add_epi8(Low, High),
+                               _mm256_setzero_si256()));
+  }
+  uint64_t Count = _mm256_extract_epi64(Total, 0) +
+                   _mm256_extract_epi64(Total, 1) +
+                   _mm256_extract_epi64(Total, 2) +
+                   _mm256_extract_epi64(Total, 3);
+  return Count + popcountAndScalar(A + I, B + I, Words - I);
+}
+#endif
+
+using PopcountAnd = uint64_t (*)(const uint64_t *, const uint64_t *, size_t);
+
+PopcountAnd selectPopcountAnd() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) {
+    return popcountAndAVX2;
+  }
+#endif
+  return popcountAndScalar;
+}
+
+/**
+ * @brief Count, for every predicate, the successful and failing runs in
+ * which it was observed and in which it was true.
+ *
+ * The entries are first grouped by site. Then, one site at a time, the
+ * site gets a bitset of the runs that observed it and each of its
+ * predicates a bitset of the runs in which it was true, and the counts
+ * are popcounts of these bitsets and of their intersection with the
+ * bitset of failing runs. The bitsets of a single site stay in cache.
+ */
+void countPredicates(const cbi_matrix_header &Header,
+                     const std::vector<cbi_matrix_run> &Runs,
+                     const std::vector<cbi_matrix_entry> &Entries,
+                     const std::vector<uint32_t> &FirstPredicate,
+                     std::vector<Predicate> &Predicates) {
+  PopcountAnd Count = selectPopcountAnd();
+  size_t NumSites = Header.num_sites;
+  size_t Words = (Runs.size() + 63) / 64;
+
+  std::vector<uint64_t> Failing(Words);
+  std::vector<uint64_t> SiteStart(NumSites + 1);
+  for (size_t R = 0; R < Runs.size(); ++R) {
+    if (Runs[R].failed) {
+      Failing[R / 64] |= 1ull << (R % 64);
+    }
+    for (uint64_t E = Runs[R].first_entry;
+         E < Runs[R].first_entry + Runs[R].num_entries; ++E) {
+      SiteStart[Entries[E].site + 1]++;
+    }
+  }
+  for (size_t Site = 0; Site < NumSites; ++Site) {
+    SiteStart[Site + 1] += SiteStart[Site];
+  }
+  // Runs and bits of every entry, grouped by site and in run order.
+  std::vector<uint32_t> SiteRuns(Entries.size());
+  std::vector<uint8_t> SiteBits(Entries.size());
+  std::vector<uint64_t> Next(SiteStart.begin(), SiteStart.end() - 1);
+  for (size_t R = 0; R < Runs.size(); ++R) {
+    for (uint64_t E = Runs[R].first_entry;
+         E < Runs[R].first_entry + Runs[R].num_entries; ++E) {
+      uint64_t Slot = Next[Entries[E].site]++;
+      SiteRuns[Slot] = R;
+      SiteBits[Slot] = Entries[E].bits;
+    }
+  }
+
+  // Bitset 0 holds the observing runs, bitset K + 1 those where predicate
+  // K of the site is true.
+  std::vector<uint64_t> Sets(4 * Words);
+  for (size_t Site = 0; Site < NumSites; ++Site) {
+    if (SiteStart[Site] == SiteStart[Site + 1]) {
+      continue;
+    }
+    // The size of each set is counted while it is filled, so only the
+    // intersections need a popcount. A run may have several entries for a
+    // site when sites share a location.
+    uint64_t SetSize[4] = {0, 0, 0, 0};
+    for (uint64_t E = SiteStart[Site]; E < SiteStart[Site + 1]; ++E) {
+      uint64_t Bit = 1ull << (SiteRuns[E] % 64);
+      for (int Set = 0; Set < 4; ++Set) {
+        uint64_t &Word = Sets[Set * Words + SiteRuns[E] / 64];
+        if ((SiteBits[E] & (1 << Set)) && !(Word & Bit)) {
+          Word |= Bit;
+          SetSize[Set]++;
+        }
+      }
+    }
+
+    // Only the words between the first and last run of the site are set.
+    size_t First = SiteRuns[SiteStart[Site]] / 64;
+    size_t Size = SiteRuns[SiteStart[Site + 1] - 1] / 64 + 1 - First;
+    const uint64_t *Fail = &Failing[First];
+    uint64_t FObs = Count(&Sets[First], Fail, Size);
+    for (auto P = FirstPredicate[Site]; P < FirstPredicate[Site + 1]; ++P) {
+      int Set = P - FirstPredicate[Site] + 1;
+      uint64_t F = Count(&Sets[Set * Words + First], Fail, Size);
+      Predicates[P].F = F;
+      Predicates[P].S = SetSize[Set] - F;
+      Predicates[P].FObs = FObs;
+      Predicates[P].SObs = SetSize[0] - FObs;
+    }
+
+    for (uint64_t E = SiteStart[Site]; E < SiteStart[Site + 1]; ++E) {
+      for (int Set = 0; Set < 4; ++Set) {
+        Sets[Set * Words + SiteRuns[E] / 64] = 0;
+      }
+    }
+  }
+}
+
+/// Shortest representation that reads back as X, like Python's repr. Any
+/// double that has one with at most 15 digits prints as such with %.15g.
+std::string formatFloat(double X) {
+  char Buffer[32];
+  for (int Precision = 15; Precision <= 17; ++Precision) {
+    snprintf(Buffer, sizeof(Buffer), "%.*g", Precision, X);
+    if (strtod(Buffer, NULL) == X) {
+      break;
+    }
+  }
+  std::string Result(Buffer);
+  if (Result.find_first_of(".en") == std::string::npos) {
+    Result += ".0";
+  }
+  return Result;
+}
+
+/// Same layout as cbi's Report.__str__.
+void printReport(FILE *Out, const std::vector<Predicate> &Predicates) {
+  const char *Titles[] = {"S(P)", "F(P)", "Failure(P)", "Context(P)",
+                          "Increase(P)"};
+  for (int Section = 0; Section < 5; ++Section) {
+    fprintf(Out, "%s== %s ==\n", Section ? "\n" : "", Titles[Section]);
+    for (size_t I = 0; I < Predicates.size(); ++I) {
+      auto &P = Predicates[I];
+      std::string Value =
+          Section == 0   ? std::to_string(P.S)
+          : Section == 1 ? std::to_string(P.F)
+          : Section == 2 ? formatFloat(P.failure())
+          : Section == 3 ? formatFloat(P.context())
+                         : formatFloat(P.increase());
+      fprintf(Out, "%sLine %03d, Col %03d, %14s: %s", I ? "\n" : "", P.Line,
+              P.Col, P.Type.c_str(), Value.c_str());
+    }
+  }
+  fprintf(Out, "\n");
+}
+
+/// Same layout as json.dump(asdict(report), indent=4).
+void writeReport(FILE *Out, const std::vector<Predicate> &Predicates) {
+  if (Predicates.empty()) {
+    fprintf(Out, "{\n    \"predicate_info_list\": []\n}");
+    return;
+  }
+  fprintf(Out, "{\n    \"predicate_info_list\": [\n");
+  for (size_t I = 0; I < Predicates.size(); ++I) {
+    auto &P = Predicates[I];
+    fprintf(Out,
+            "        {\n"
+            "            \"predicate\": {\n"
+            "                \"line\": %d,\n"
+            "                \"column\": %d,\n"
+            "                \"pred_type\": \"%s\"\n"
+            "            },\n"
+            "            \"num_true_in_success\": %llu,\n"
+            "            \"num_true_in_failure\": %llu,\n"
+            "            \"num_observed_in_success\": %llu,\n"
+            "            \"num_observed_in_failure\": %llu,\n"
+            "            \"failure\": %s,\n"
+            "            \"context\": %s,\n"
+            "            \"increase\": %s\n"
+            "        }%s\n",
+            P.Line, P.Col, P.Type.c_str(), (unsigned long long)P.S,
+            (unsigned long long)P.F, (unsigned long long)P.SObs,
+            (unsigned long long)P.FObs, formatFloat(P.failure()).c_str(),
+            formatFloat(P.context()).c_str(),
+            formatFloat(P.increase()).c_str(),
+            I + 1 < Predicates.size() ? "," : "");
+  }
+  fprintf(Out, "    ]\n}");
+}
+
+/**
+ * Compute the CBI report from a predicate matrix written by cbi-collect.
+ * The report is printed and written as JSON, in the same format as cbi.
+ * Without an output file, the matrix path with ".cbi.matrix" replaced by
+ * ".report.json" is used.
+ *
+ * Usage:
+ * ./cbi-score [matrix] (output file)
+ */
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [matrix] (output file)\n", argv[0]);
+    return 1;
+  }
+  std::string MatrixPath(argv[1]);
+  std::string OutPath;
+  if (argc > 2) {
+    OutPath = argv[2];
+  } else {
+    size_t Suffix = MatrixPath.rfind(CBI_MATRIX_EXTENSION);
+    OutPath = (Suffix != std::string::npos ? MatrixPath.substr(0, Suffix)
+                                           : MatrixPath) +
+              ".report.json";
+  }
+
+  FILE *Matrix = fopen(MatrixPath.c_str(), "rb");
+  if (!Matrix) {
+    fprintf(stderr, "%s not found\n", MatrixPath.c_str());
+    return 1;
+  }
+  cbi_matrix_header Header;
+  if (fread(&Header, sizeof(Header), 1, Matrix) != 1 ||
+      Header.magic != CBI_MATRIX_MAGIC) {
+    fprintf(stderr, "%s is not a CBI matrix\n", MatrixPath.c_str());
+    return 1;
+  }
+  std::vector<cbi_matrix_site> Sites(Header.num_sites);
+  std::vector<cbi_matrix_run> Runs(Header.num_runs);
+  std::vector<cbi_matrix_entry> Entries(Header.num_entries);
+  std::string Names(Header.names_size, 0);
+  if (fread(Sites.data(), sizeof(cbi_matrix_site), Sites.size(), Matrix) !=
+          Sites.size() ||
+      fread(Runs.data(), sizeof(cbi_matrix_run), Runs.size(), Matrix) !=
+          Runs.size() ||
+      fread(Entries.data(), sizeof(cbi_matrix_entry), Entries.size(),
+            Matrix) != Entries.size() ||
+      fread(&Names[0], 1, Names.size(), Matrix) != Names.size()) {
+    fprintf(stderr, "%s is truncated\n", MatrixPath.c_str());
+    return 1;
+  }
+  fclose(Matrix);
+
+  std::vector<Predicate> Predicates;
+  std::vector<uint32_t> FirstPredicate;
+  for (uint32_t Site = 0; Site < Sites.size(); ++Site) {
+    FirstPredicate.push_back(Predicates.size());
+    int Kind = Sites[Site].kind;
+    // A pair site named "x y" has the predicates x < y, x == y and x > y.
+    std::string Assigned, Other;
+    if (Kind == CBI_PAIR_SITE) {
+      std::string Name(Sites[Site].name < Names.size()
+                           ? Names.c_str() + Sites[Site].name
+                           : "");
+      size_t Space = Name.find(' ');
+      Assigned = Name.substr(0, Space);
+      Other = Space == std::string::npos ? "" : Name.substr(Space + 1);
+    }
+    for (int K = 0; K < (Kind == CBI_BRANCH_SITE ? 2 : 3); ++K) {
+      Predicate P;
+      P.Site = Site;
+      P.Line = Sites[Site].line;
+      P.Col = Sites[Site].col;
+      P.Type = Kind == CBI_BRANCH_SITE   ? BRANCH_TYPES[K]
+               : Kind == CBI_RETURN_SITE ? RETURN_TYPES[K]
+                                         : Assigned + " " + PAIR_OPERATORS[K] +
+                                               " " + Other;
+      Predicates.push_back(P);
+    }
+  }
+  FirstPredicate.push_back(Predicates.size());
+
+  countPredicates(Header, Runs, Entries, FirstPredicate, Predicates);
+
+  // Same order as cbi, by line, column and predicate type.
+  std::sort(Predicates.begin(), Predicates.end(),
+            [](const Predicate &A, const Predicate &B) {
+              if (A.Line != B.Line) {
+                return A.Line < B.Line;
+              }
+              if (A.Col != B.Col) {
+                return A.Col < B.Col;
+              }
+              return A.Type < B.Type;
+            });
+
+  printReport(stdout, Predicates);
+  FILE *Out = fopen(OutPath.c_str(), "w");
+  if (!Out) {
+    fprintf(stderr, "Cannot write %s\n", OutPath.c_str());
+    return 1;
+  }
+  writeReport(Out, Predicates);
+  return fclose(Out) ? 1 : 0;
+}